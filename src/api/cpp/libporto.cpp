@@ -1,5 +1,7 @@
 #include "libporto.hpp"
 
+#include <set>
+
 #include <google/protobuf/text_format.h>
 #include <google/protobuf/io/zero_copy_stream_impl.h>
 #include <google/protobuf/io/coded_stream.h>
@@ -29,6 +31,11 @@ public:
     int LastError = 0;
     std::string LastErrorMsg;
 
+    /* pipelined requests in flight and their early responses */
+    uint64_t LastReqId = 0;
+    std::set<uint64_t> Pipelined;
+    std::map<uint64_t, rpc::TContainerResponse> Completed;
+
     int Error(int err, const std::string &prefix) {
         LastError = EError::Unknown;
         LastErrorMsg = std::string(prefix + ": " + strerror(err));
@@ -50,11 +57,15 @@ public:
         if (Fd >= 0)
             close(Fd);
         Fd = -1;
+        Pipelined.clear();
+        Completed.clear();
     }
 
     int Send();
     int Recv();
     int Rpc();
+
+    int RecvPipelined(uint64_t id);
 };
 
 int Connection::ConnectionImpl::Connect()
@@ -134,18 +145,49 @@ int Connection::ConnectionImpl::Recv() {
     return Error(raw.GetErrno() ?: EIO, "recv");
 }
 
+/* Receive response for request id, stash responses for others */
+int Connection::ConnectionImpl::RecvPipelined(uint64_t id) {
+    auto it = Completed.find(id);
+    if (it != Completed.end()) {
+        Rsp.Swap(&it->second);
+        Completed.erase(it);
+        return EError::Success;
+    }
+
+    while (true) {
+        Rsp.Clear();
+        int ret = Recv();
+        if (ret)
+            return ret;
+        Pipelined.erase(Rsp.reqid());
+        if (!id || Rsp.reqid() == id)
+            return EError::Success;
+        Completed[Rsp.reqid()].Swap(&Rsp);
+    }
+}
+
 int Connection::ConnectionImpl::Rpc() {
     int ret = 0;
 
     if (Fd < 0)
         ret = Connect();
 
+    /* responses for pipelined requests could come first */
+    uint64_t id = 0;
+    if (!Pipelined.empty()) {
+        id = ++LastReqId;
+        Req.set_reqid(id);
+        Pipelined.insert(id);
+    }
+
     if (!ret)
         ret = Send();
 
     Req.Clear();
 
-    if (!ret) {
+    if (!ret && id)
+        ret = RecvPipelined(id);
+    else if (!ret) {
         Rsp.Clear();
         ret = Recv();
     }
@@ -192,6 +234,50 @@ int Connection::Raw(const std::string &message, std::string &responce) {
     return ret;
 }
 
+int Connection::SendRaw(const std::string &message, uint64_t &id) {
+    if (!google::protobuf::TextFormat::ParseFromString(message, &Impl->Req) ||
+        !Impl->Req.IsInitialized())
+        return -1;
+
+    int ret = 0;
+    if (Impl->Fd < 0)
+        ret = Impl->Connect();
+
+    id = ++Impl->LastReqId;
+    Impl->Req.set_reqid(id);
+
+    if (!ret)
+        ret = Impl->Send();
+
+    Impl->Req.Clear();
+
+    if (!ret)
+        Impl->Pipelined.insert(id);
+
+    return ret;
+}
+
+int Connection::RecvRaw(uint64_t &id, std::string &response) {
+    if (Impl->Completed.empty() && Impl->Pipelined.empty())
+        return -1;
+
+    int ret;
+    if (!Impl->Completed.empty())
+        ret = Impl->RecvPipelined(Impl->Completed.begin()->first);
+    else
+        ret = Impl->RecvPipelined(0);
+
+    if (!ret) {
+        id = Impl->Rsp.reqid();
+        response = Impl->Rsp.ShortDebugString();
+        Impl->LastErrorMsg = Impl->Rsp.errormsg();
+        Impl->LastError = (int)Impl->Rsp.error();
+        ret = Impl->LastError;
+    }
+
+    return ret;
+}
+
 int Connection::Create(const std::string &name) {
     Impl->Req.mutable_create()->set_name(name);
 
@@ -724,4 +810,29 @@ int Connection::LocateProcess(int pid, const std::string &comm,
     return ret;
 }
 
+int Connection::DumpTraces(std::vector<RequestTrace> &traces, bool slowest) {
+    Impl->Req.mutable_trace()->set_slowest(slowest);
+
+    int ret = Impl->Rpc();
+    if (ret)
+        return ret;
+
+    traces.clear();
+    for (auto &msg: Impl->Rsp.trace().trace()) {
+        RequestTrace trace;
+
+        trace.Request = msg.request();
+        trace.Client = msg.client();
+        trace.Time = msg.time();
+        trace.TotalUs = msg.total_us();
+        trace.Error = msg.error();
+        for (auto &stage: msg.stage())
+            trace.Stages.emplace_back(stage.name(), stage.time_us());
+
+        traces.push_back(trace);
+    }
+
+    return ret;
+}
+
 } /* namespace Porto */
@@ -34,6 +34,16 @@ struct Storage {
     uint64_t LastUsage;
 };
 
+struct RequestTrace {
+    std::string Request;
+    std::string Client;
+    uint64_t Time;
+    uint64_t TotalUs;
+    int Error;
+    /* stage name -> microseconds */
+    std::vector<std::pair<std::string, uint64_t>> Stages;
+};
+
 struct GetResponse {
     std::string Value;
     int Error;
@@ -101,6 +111,13 @@ public:
     int GetVersion(std::string &tag, std::string &revision);
 
     int Raw(const std::string &message, std::string &response);
+
+    /*
+     * Pipelining: requests in text format are sent without waiting for
+     * previous responses, responses come in order of completion.
+     */
+    int SendRaw(const std::string &message, uint64_t &id);
+    int RecvRaw(uint64_t &id, std::string &response);
     void GetLastError(int &error, std::string &msg) const;
 
     int ListVolumeProperties(std::vector<Property> &list);
@@ -157,6 +174,8 @@ public:
     int AttachProcess(const std::string &name,
                       int pid, const std::string &comm);
     int LocateProcess(int pid, const std::string &comm, std::string &name);
+
+    int DumpTraces(std::vector<RequestTrace> &traces, bool slowest = false);
 };
 
 } /* namespace Porto */
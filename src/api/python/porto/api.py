@@ -69,6 +69,7 @@ class _RPC(object):
         self.sock = None
         self.deadline = None
         self.auto_reconnect = auto_reconnect
+        self.reqid = 0
 
     def _set_locked(fn):
         def _lock(*args, **kwargs):
@@ -172,7 +173,7 @@ class _RPC(object):
         self._send_hdr(hdr)
         self._senddata(data)
 
-    def _recv_response(self):
+    def _recv_message(self):
         msb = 1
         buf = ""
         while msb:
@@ -189,6 +190,10 @@ class _RPC(object):
 
         buf += self._recvdata(length[0])
         resp.ParseFromString(buf[length[1]:])
+        return resp
+
+    def _recv_response(self):
+        resp = self._recv_message()
 
         if resp.error != rpc_pb2.Success:
             raise exceptions.EError.Create(resp.error, resp.errorMsg)
@@ -207,6 +212,72 @@ class _RPC(object):
 
         return self._recv_response()
 
+    @_set_locked
+    @_set_deadline
+    def call_pipelined(self, requests, timeout):
+        # requests do not wait for each other, responses come out of order
+        for request in requests:
+            self.reqid += 1
+            request.reqid = self.reqid
+            self._send_request(request)
+
+        if timeout is None:
+            self.deadline = None
+        elif timeout > self.timeout:
+            self.deadline += timeout - self.timeout
+
+        responses = {}
+        while len(responses) < len(requests):
+            resp = self._recv_message()
+            responses[resp.reqid] = resp
+
+        return [responses[request.reqid] for request in requests]
+
+    @_set_locked
+    @_set_deadline
+    def subscribe(self, request, timeout):
+        # responses for this tag keep coming until unsubscribe
+        self.reqid += 1
+        request.reqid = self.reqid
+        self._send_request(request)
+
+        if timeout is None:
+            self.deadline = None
+        elif timeout > self.timeout:
+            self.deadline += timeout - self.timeout
+
+        return self._recv_response()
+
+    @_set_locked
+    @_set_deadline
+    def recv_events(self, timeout):
+        if timeout is None:
+            self.deadline = None
+        elif timeout > self.timeout:
+            self.deadline += timeout - self.timeout
+
+        return self._recv_response()
+
+    @_set_locked
+    @_set_deadline
+    def unsubscribe(self, request, timeout):
+        self._send_request(request)
+
+        if timeout is None:
+            self.deadline = None
+        elif timeout > self.timeout:
+            self.deadline += timeout - self.timeout
+
+        # skip events and final response of subscription
+        while True:
+            resp = self._recv_message()
+            if not resp.HasField('reqid'):
+                break
+
+        if resp.error != rpc_pb2.Success:
+            raise exceptions.EError.Create(resp.error, resp.errorMsg)
+        return resp
+
     @_set_locked
     @_set_deadline
     @_check_deadline
@@ -395,6 +466,42 @@ class Connection(object):
     def disconnect(self):
         self.rpc.disconnect()
 
+    def Pipeline(self, requests, timeout=None):
+        """Send several TContainerRequest at once, return responses or
+        errors in the same order. Requests are executed concurrently."""
+        if timeout is None:
+            timeout = self.rpc.timeout
+        res = []
+        for resp in self.rpc.call_pipelined(requests, timeout):
+            if resp.error != rpc_pb2.Success:
+                res.append(exceptions.EError.Create(resp.error, resp.errorMsg))
+            else:
+                res.append(resp)
+        return res
+
+    def Subscribe(self, names=None, types=None, since=None, timeout=None):
+        """Subscribe connection to events, return TSubscribeResponse with
+        current seq and events after since. Use dedicated connection:
+        following events must be read with ReadEvents."""
+        request = rpc_pb2.TContainerRequest()
+        request.subscribe.CopyFrom(rpc_pb2.TSubscribeRequest())
+        if names is not None:
+            request.subscribe.name.extend(names)
+        if types is not None:
+            request.subscribe.type.extend(types)
+        if since is not None:
+            request.subscribe.since = since
+        return self.rpc.subscribe(request, timeout).subscribe
+
+    def ReadEvents(self, timeout=None):
+        """Wait for next pushed events, return TSubscribeResponse"""
+        return self.rpc.recv_events(timeout).subscribe
+
+    def Unsubscribe(self):
+        request = rpc_pb2.TContainerRequest()
+        request.unsubscribe.CopyFrom(rpc_pb2.TUnsubscribeRequest())
+        self.rpc.unsubscribe(request, self.rpc.timeout)
+
     def List(self, mask=None):
         request = rpc_pb2.TContainerRequest()
         request.list.CopyFrom(rpc_pb2.TContainerListRequest())
@@ -558,6 +665,31 @@ class Connection(object):
             raise exceptions.EError.Create(resp.error, resp.errorMsg)
         return resp.wait.name
 
+    def Async(self, request):
+        """Start heavy TContainerRequest in background, return operation id"""
+        setattr(request, "async", True)
+        return self.rpc.call(request, self.rpc.timeout).operation.id
+
+    def Operation(self, id, timeout=None, cancel=False):
+        """Return TOperationResponse with state, progress and result,
+        optionally wait for completion or cancel operation"""
+        request = rpc_pb2.TContainerRequest()
+        request.operation.id = id
+        if cancel:
+            request.operation.cancel = True
+        if timeout is not None and timeout >= 0:
+            request.operation.timeout = timeout
+            resp = self.rpc.call(request, timeout)
+        else:
+            resp = self.rpc.call(request, self.rpc.timeout)
+        return resp.operation
+
+    def Traces(self, slowest=False):
+        """Return list of TRequestTrace, recent or slowest requests"""
+        request = rpc_pb2.TContainerRequest()
+        request.trace.slowest = slowest
+        return self.rpc.call(request, self.rpc.timeout).trace.trace
+
     def CreateVolume(self, path=None, layers=[], **properties):
         if layers:
             layers = [l.name if isinstance(l, Layer) else l for l in layers]
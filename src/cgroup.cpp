@@ -5,9 +5,14 @@
 #include "cgroup.hpp"
 #include "device.hpp"
 #include "config.hpp"
+#include "trace.hpp"
 #include "util/log.hpp"
 #include "util/string.hpp"
 #include "util/unix.hpp"
+#include "util/locks.hpp"
+
+#include <list>
+#include <set>
 
 extern "C" {
 #include <fcntl.h>
@@ -30,6 +35,139 @@ const TFlagsNames ControllersName = {
     { CGROUP_SYSTEMD,   "systemd" },
 };
 
+/*
+ * Open descriptors of frequently read statistics knobs, knob is read with
+ * pread at offset 0 which regenerates its content. Count of descriptors is
+ * bounded, least recently used are closed first. Descriptors are shared,
+ * so eviction never closes file under reader.
+ */
+class TKnobCache : public TLockable {
+    struct TEntry {
+        std::shared_ptr<TFile> File;
+        std::list<std::string>::iterator Lru;
+    };
+
+    std::map<std::string, TEntry> Entries;
+    std::list<std::string> Lru;
+
+public:
+    TError Open(const TPath &path, std::shared_ptr<TFile> &file) {
+        auto lock = ScopedLock();
+        auto it = Entries.find(path.ToString());
+
+        if (it != Entries.end()) {
+            Lru.splice(Lru.begin(), Lru, it->second.Lru);
+            file = it->second.File;
+            return TError::Success();
+        }
+
+        lock.unlock();
+        file = std::make_shared<TFile>();
+        TError error = file->OpenRead(path);
+        if (error)
+            return error;
+        lock.lock();
+
+        size_t budget = config().daemon().cgroup_knob_fds();
+        while (Entries.size() >= budget && !Lru.empty()) {
+            Entries.erase(Lru.back());
+            Lru.pop_back();
+        }
+
+        /* raced with other reader */
+        if (Entries.count(path.ToString()))
+            return TError::Success();
+
+        Lru.push_front(path.ToString());
+        Entries[path.ToString()] = { file, Lru.begin() };
+        return TError::Success();
+    }
+
+    void Forget(const TPath &path) {
+        auto lock = ScopedLock();
+        auto it = Entries.find(path.ToString());
+        if (it != Entries.end()) {
+            Lru.erase(it->second.Lru);
+            Entries.erase(it);
+        }
+    }
+
+    /* Forget all knobs of cgroup */
+    void Invalidate(const TPath &cgroup) {
+        auto lock = ScopedLock();
+        std::string prefix = cgroup.ToString() + "/";
+        auto it = Entries.lower_bound(prefix);
+        while (it != Entries.end() && StringStartsWith(it->first, prefix)) {
+            Lru.erase(it->second.Lru);
+            it = Entries.erase(it);
+        }
+    }
+};
+
+static TKnobCache KnobCache;
+
+static const std::set<std::string> HotKnobs = {
+    "memory.usage_in_bytes",
+    "memory.max_usage_in_bytes",
+    "memory.stat",
+    "memory.anon.usage",
+    "cpuacct.usage",
+    "cpuacct.stat",
+    "cpuacct.wait",
+    "blkio.io_service_bytes_recursive",
+    "blkio.io_serviced_recursive",
+    "blkio.io_service_time_recursive",
+    "blkio.throttle.io_service_bytes",
+    "blkio.throttle.io_serviced",
+    "pids.current",
+    "hugetlb.2MB.usage_in_bytes",
+};
+
+static TError ReadHotKnob(const TPath &path, std::string &value) {
+    if (!config().daemon().cgroup_knob_fds())
+        return path.ReadAll(value);
+
+    std::shared_ptr<TFile> file;
+    TError error = KnobCache.Open(path, file);
+    if (error)
+        return error;
+
+    error = file->PreadAll(value, 1048576);
+    if (error) {
+        /* cgroup might be recreated behind us */
+        KnobCache.Forget(path);
+        error = path.ReadAll(value);
+    }
+
+    return error;
+}
+
+__thread TCgroupStatContext *TCgroupStatContext::Current = nullptr;
+
+TError TCgroup::ReadKnob(const std::string &knob, std::string &value) const {
+    TTraceScope trace(TraceCgroup);
+    TPath path = Knob(knob);
+
+    if (!HotKnobs.count(knob))
+        return path.ReadAll(value);
+
+    auto ctx = TCgroupStatContext::Current;
+    if (ctx) {
+        auto it = ctx->Text.find(path.ToString());
+        if (it != ctx->Text.end()) {
+            value = it->second.second;
+            return it->second.first;
+        }
+    }
+
+    TError error = ReadHotKnob(path, value);
+
+    if (ctx)
+        ctx->Text[path.ToString()] = { error, value };
+
+    return error;
+}
+
 TPath TCgroup::Path() const {
     if (!Subsystem)
         return TPath();
@@ -121,6 +259,7 @@ TError TCgroup::RemoveOne() {
         return TError(EError::Unknown, "Cannot create secondary cgroup " + Type());
 
     L_ACT("Remove cgroup {}", *this);
+    KnobCache.Invalidate(Path());
     error = Path().Rmdir();
 
     //FIXME CLEANUP
@@ -161,7 +300,7 @@ bool TCgroup::Has(const std::string &knob) const {
 TError TCgroup::Get(const std::string &knob, std::string &value) const {
     if (!Subsystem)
         return TError(EError::Unknown, "Cannot get from null cgroup");
-    TError error = Knob(knob).ReadAll(value);
+    TError error = ReadKnob(knob, value);
     if (error)
         error = TError(error, "Cannot get cgroup " + knob);
     return error;
@@ -170,6 +309,7 @@ TError TCgroup::Get(const std::string &knob, std::string &value) const {
 TError TCgroup::Set(const std::string &knob, const std::string &value) const {
     if (!Subsystem)
         return TError(EError::Unknown, "Cannot set to null cgroup");
+    TTraceScope trace(TraceCgroup);
     L_ACT("Set {} {} = {}", *this, knob, value);
     TError error = Knob(knob).WriteAll(value);
     if (error)
@@ -217,19 +357,35 @@ TError TCgroup::GetUintMap(const std::string &knob, TUintMap &value) const {
     if (!Subsystem)
         return TError(EError::Unknown, "Cannot get from null cgroup");
 
-    FILE *file = fopen(Knob(knob).c_str(), "r");
-    char *key;
-    unsigned long long val;
+    auto ctx = TCgroupStatContext::Current;
+    if (ctx) {
+        auto it = ctx->Maps.find(Knob(knob).ToString());
+        if (it != ctx->Maps.end()) {
+            for (auto &kv: it->second)
+                value[kv.first] = kv.second;
+            return TError::Success();
+        }
+    }
 
-    if (!file)
-        return TError(EError::Unknown, errno, "Cannot open knob " + knob);
+    std::string text;
+    TError error = ReadKnob(knob, text);
+    if (error)
+        return TError(error, "Cannot get cgroup " + knob);
 
-    while (fscanf(file, "%ms %llu\n", &key, &val) == 2) {
-        value[std::string(key)] = val;
-        free(key);
+    TUintMap map;
+    for (auto &line: SplitString(text, '\n')) {
+        auto word = SplitString(line, ' ');
+        uint64_t val;
+        if (word.size() == 2 && !StringToUint64(word[1], val))
+            map[word[0]] = val;
     }
 
-    fclose(file);
+    for (auto &kv: map)
+        value[kv.first] = kv.second;
+
+    if (ctx)
+        ctx->Maps[Knob(knob).ToString()] = std::move(map);
+
     return TError::Success();
 }
 
@@ -319,6 +475,7 @@ TError TCgroup::GetPids(const std::string &knob, std::vector<pid_t> &pids) const
     if (!Subsystem)
         return TError(EError::Unknown, "Cannot get from null cgroup");
 
+    TTraceScope trace(TraceCgroup);
     pids.clear();
     file = fopen(Knob(knob).c_str(), "r");
     if (!file)
@@ -943,9 +1100,11 @@ TError TBlkioSubsystem::GetIoStat(TCgroup &cg, enum IoStat stat, TUintMap &map)
     } else
         knob = (stat & IoStat::Iops) ? "blkio.io_serviced_recursive" : "blkio.io_service_bytes_recursive";
 
-    error = cg.Knob(knob).ReadLines(lines);
+    std::string text;
+    error = cg.ReadKnob(knob, text);
     if (error)
         return error;
+    lines = SplitString(text, '\n');
 
     if (!recursive) {
         std::vector<TCgroup> list;
@@ -955,9 +1114,11 @@ TError TBlkioSubsystem::GetIoStat(TCgroup &cg, enum IoStat stat, TUintMap &map)
             return error;
 
         for (auto &child_cg: list) {
-            error = child_cg.Knob(knob).ReadLines(lines);
+            error = child_cg.ReadKnob(knob, text);
             if (error)
                 return error;
+            for (auto &line: SplitString(text, '\n'))
+                lines.push_back(line);
         }
     }
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <map>
 
 #include "common.hpp"
 #include "config.hpp"
@@ -50,6 +51,21 @@ public:
     bool IsBound(const TCgroup &cgroup) const;
 };
 
+/*
+ * Request scoped cache of statistics knobs: while context is alive each
+ * hot knob is read and parsed by this thread at most once.
+ */
+struct TCgroupStatContext : public TNonCopyable {
+    std::map<std::string, std::pair<TError, std::string>> Text;
+    std::map<std::string, TUintMap> Maps;
+    TCgroupStatContext *Prev;
+
+    static __thread TCgroupStatContext *Current;
+
+    TCgroupStatContext() : Prev(Current) { Current = this; }
+    ~TCgroupStatContext() { Current = Prev; }
+};
+
 class TCgroup {
 public:
     const TSubsystem *Subsystem = nullptr;
@@ -109,6 +125,7 @@ public:
     TError AttachAll(const TCgroup &cg) const;
 
     TPath Knob(const std::string &knob) const;
+    TError ReadKnob(const std::string &knob, std::string &value) const;
     bool Has(const std::string &knob) const;
     TError Get(const std::string &knob, std::string &value) const;
     TError Set(const std::string &knob, const std::string &value) const;
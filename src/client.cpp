@@ -1,6 +1,8 @@
 #include <algorithm>
 #include <sstream>
 #include <iomanip>
+#include <cstring>
+#include <unordered_map>
 
 #include "rpc.hpp"
 #include "client.hpp"
@@ -16,10 +18,13 @@
 #include "event.hpp"
 
 #include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream.h>
 
 extern "C" {
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <unistd.h>
 }
@@ -27,13 +32,16 @@ extern "C" {
 TClient SystemClient("<system>");
 __thread TClient *CL = nullptr;
 
-TClient::TClient(int fd) : TEpollSource(fd) {
+thread_local std::shared_ptr<TContainer> TClient::LockedContainer;
+__thread uint64_t TClient::RequestTimeMs;
+
+TClient::TClient(int fd) : TEpollSource(fd), Processing(0), Executing(0), Dropping(false) {
     ConnectionTime = GetCurrentTimeMs();
     ActivityTimeMs = ConnectionTime;
     Statistics->ClientsCount++;
 }
 
-TClient::TClient(const std::string &special) {
+TClient::TClient(const std::string &special) : Processing(0), Executing(0), Dropping(false) {
     Cred = TCred(RootUser, RootGroup);
     TaskCred = TCred(RootUser, RootGroup);
     Comm = special;
@@ -42,24 +50,49 @@ TClient::TClient(const std::string &special) {
 
 TClient::~TClient() {
     CloseConnection();
-    if (AccessLevel != EAccessLevel::Internal) {
+    if (AccessLevel != EAccessLevel::Internal && !Detached) {
         Statistics->ClientsCount--;
         if (ClientContainer)
             ClientContainer->ClientsCount--;
     }
 }
 
+std::shared_ptr<TClient> TClient::DetachIdentity() {
+    auto client = std::make_shared<TClient>(Comm);
+
+    std::unique_lock<std::mutex> lock(IdentityMutex);
+
+    client->Detached = true;
+    client->Id = Id;
+    client->Cred = Cred;
+    client->TaskCred = TaskCred;
+    client->Pid = Pid;
+    client->UserCtGroup = UserCtGroup;
+    client->ClientContainer = ClientContainer;
+    client->AccessLevel = AccessLevel;
+    client->PortoNamespace = PortoNamespace;
+    client->WriteNamespace = WriteNamespace;
+    client->Generation = Generation;
+
+    return client;
+}
+
 void TClient::CloseConnection() {
     TScopedLock lock(Mutex);
 
     if (Fd >= 0) {
-        if (InEpoll)
-            EpollLoop->RemoveSource(Fd);
+        if (Loop)
+            Loop->RemoveSource(Fd);
         ConnectionTime = GetCurrentTimeMs() - ConnectionTime;
         if (Verbose)
             L("Client disconnected: {}: {} ms", Id, ConnectionTime);
         close(Fd);
         Fd = -1;
+
+        Buffer.Release();
+        Offset = Length = 0;
+        Output.clear();
+        OutOffset = 0;
     }
 
     for (auto &weakCt: WeakContainers) {
@@ -86,37 +119,124 @@ void TClient::FinishRequest() {
     CL = nullptr;
 }
 
+void TClient::FinishExecution() {
+    TScopedLock lock(Mutex);
+
+    if (!--Executing && Stale) {
+        Stale = false;
+        if (Fd >= 0)
+            (void)UpdateEvents();
+    }
+}
+
+std::atomic<uint64_t> TClient::IdentityGeneration(1);
+
+/* called from client loop, which is the only one who changes identity */
+bool TClient::IdentityChanged() const {
+    return !ClientContainer ||
+        Generation != IdentityGeneration + ClientContainer->GetClientsGeneration();
+}
+
+/*
+ * Container of recently connected pids. Entry is valid while no task
+ * was moved between containers and /proc/<pid> is the same task: new
+ * task with reused pid gets new proc inode with different ctime.
+ */
+struct TPidIdentity {
+    struct timespec Start;
+    uint64_t Generation;
+    std::string Comm;
+    std::weak_ptr<TContainer> Container;
+};
+
+static std::mutex PidCacheMutex;
+static std::unordered_map<pid_t, TPidIdentity> PidCache;
+static constexpr size_t PID_CACHE_SIZE = 4096;
+
+static TError FindClientContainer(pid_t pid, uint64_t generation, std::string &comm,
+                                  std::shared_ptr<TContainer> &ct) {
+    struct stat st;
+
+    if (stat(("/proc/" + std::to_string(pid)).c_str(), &st))
+        return TError(EError::Unknown, errno, "Cannot find task " + std::to_string(pid));
+
+    PidCacheMutex.lock();
+    auto it = PidCache.find(pid);
+    if (it != PidCache.end() && it->second.Generation == generation &&
+            it->second.Start.tv_sec == st.st_ctim.tv_sec &&
+            it->second.Start.tv_nsec == st.st_ctim.tv_nsec) {
+        ct = it->second.Container.lock();
+        comm = it->second.Comm;
+    }
+    PidCacheMutex.unlock();
+
+    if (ct)
+        return TError::Success();
+
+    comm = GetTaskName(pid);
+
+    TError error = TContainer::FindTaskContainer(pid, ct);
+    if (error)
+        return error;
+
+    PidCacheMutex.lock();
+    if (PidCache.size() >= PID_CACHE_SIZE)
+        PidCache.clear();
+    PidCache[pid] = {st.st_ctim, generation, comm, ct};
+    PidCacheMutex.unlock();
+
+    return TError::Success();
+}
+
 TError TClient::IdentifyClient(bool initial) {
     std::shared_ptr<TContainer> ct;
-    struct ucred cr;
-    socklen_t len = sizeof(cr);
+    uint64_t generation = IdentityGeneration;
     TError error;
 
-    if (getsockopt(Fd, SOL_SOCKET, SO_PEERCRED, &cr, &len))
-        return TError(EError::Unknown, errno, "Cannot identify client: getsockopt() failed");
+    /* credentials of unix socket peer are fixed at connect */
+    if (initial) {
+        struct ucred cr;
+        socklen_t len = sizeof(cr);
 
-    /* check that request from the same pid and container is still here */
-    if (!initial && Pid == cr.pid && TaskCred.Uid == cr.uid &&
-            TaskCred.Gid == cr.gid && ClientContainer &&
-            (ClientContainer->State == EContainerState::Running ||
-             ClientContainer->State == EContainerState::Starting ||
-             ClientContainer->State == EContainerState::Meta))
-        return TError::Success();
+        if (getsockopt(Fd, SOL_SOCKET, SO_PEERCRED, &cr, &len))
+            return TError(EError::Unknown, errno, "Cannot identify client: getsockopt() failed");
 
-    TaskCred.Uid = cr.uid;
-    TaskCred.Gid = cr.gid;
-    Pid = cr.pid;
+        TaskCred.Uid = cr.uid;
+        TaskCred.Gid = cr.gid;
+        Pid = cr.pid;
+    } else if (!IdentityChanged())
+        return TError::Success();
 
-    Cred = TaskCred;
-    Comm = GetTaskName(Pid);
+    /* client task stays in the same container while it is alive */
+    if (!initial && ClientContainer &&
+            (ClientContainer->State == EContainerState::Running ||
+             ClientContainer->State == EContainerState::Starting ||
+             ClientContainer->State == EContainerState::Meta)) {
+        ct = ClientContainer;
+    } else {
+        error = FindClientContainer(Pid, generation, Comm, ct);
+        if (error && error.GetErrno() != ENOENT)
+            L_WRN("Cannot identify container of pid {} : {}", Pid, error);
+        if (error)
+            return error;
+    }
 
-    error = TContainer::FindTaskContainer(Pid, ct);
-    if (error && error.GetErrno() != ENOENT)
-        L_WRN("Cannot identify container of pid {} : {}", Pid, error);
+    /* taken before identity: concurrent change forces recheck */
+    generation += ct->GetClientsGeneration();
 
+    IdentityMutex.lock();
+    error = IdentifyContainer(ct);
+    IdentityMutex.unlock();
     if (error)
         return error;
 
+    Generation = generation;
+    return TError::Success();
+}
+
+TError TClient::IdentifyContainer(std::shared_ptr<TContainer> &ct) {
+    bool changed = ClientContainer != ct;
+
     AccessLevel = ct->AccessLevel;
     for (auto p = ct->Parent; p; p = p->Parent)
         AccessLevel = std::min(AccessLevel, p->AccessLevel);
@@ -135,16 +255,21 @@ TError TClient::IdentifyClient(bool initial) {
     if (ct->ClientsCount < 0)
         L_ERR("Client count underflow");
 
-    if (ClientContainer)
-        ClientContainer->ClientsCount--;
-    ClientContainer = ct;
-    ct->ClientsCount++;
+    if (changed) {
+        if (ClientContainer)
+            ClientContainer->ClientsCount--;
+        ClientContainer = ct;
+        ct->ClientsCount++;
+    }
 
     /* requests from containers are executed in behalf of their owners */
-    if (!ct->IsRoot())
-        Cred = ct->OwnerCred;
+    TCred cred = ct->IsRoot() ? TaskCred : ct->OwnerCred;
 
-    (void)Cred.LoadGroups(Cred.User());
+    /* supplementary groups are loaded only when credentials changed */
+    if (changed || cred.Uid != Cred.Uid || cred.Gid != Cred.Gid) {
+        Cred = cred;
+        (void)Cred.LoadGroups(Cred.User());
+    }
 
     if (Cred.IsRootUser()) {
         if (AccessLevel == EAccessLevel::Normal)
@@ -154,6 +279,9 @@ TError TClient::IdentifyClient(bool initial) {
             AccessLevel = EAccessLevel::ReadOnly;
     }
 
+    if (!changed)
+        return TError::Success();
+
     Id = fmt::format("{}:{}({}) CT{}:{}", Fd, Comm, Pid, ct->Id, ct->Name);
 
     if (Verbose)
@@ -224,11 +352,12 @@ TError TClient::ResolveContainer(const std::string &relative_name,
 
 TError TClient::ReadContainer(const std::string &relative_name,
                               std::shared_ptr<TContainer> &ct, bool try_lock) {
+    /* release out of ContainersMutex, write unlock publishes snapshots */
+    ReleaseContainer();
     auto lock = LockContainers();
     TError error = ResolveContainer(relative_name, ct);
     if (error)
         return error;
-    ReleaseContainer(true);
     error = ct->LockRead(lock, try_lock);
     if (error)
         return error;
@@ -240,6 +369,7 @@ TError TClient::WriteContainer(const std::string &relative_name,
                                std::shared_ptr<TContainer> &ct, bool child) {
     if (AccessLevel <= EAccessLevel::ReadOnly)
         return TError(EError::Permission, "Write access denied");
+    ReleaseContainer();
     auto lock = LockContainers();
     TError error = ResolveContainer(relative_name, ct);
     if (error)
@@ -247,7 +377,6 @@ TError TClient::WriteContainer(const std::string &relative_name,
     error = CanControl(*ct, child);
     if (error)
         return error;
-    ReleaseContainer(true);
     error = ct->Lock(lock);
     if (error)
         return error;
@@ -256,8 +385,8 @@ TError TClient::WriteContainer(const std::string &relative_name,
 }
 
 TError TClient::LockContainer(std::shared_ptr<TContainer> &ct) {
+    ReleaseContainer();
     auto lock = LockContainers();
-    ReleaseContainer(true);
     TError error = ct->Lock(lock);
     if (!error)
         LockedContainer = ct;
@@ -405,106 +534,261 @@ TError TClient::WriteAccess(const TFile &file) {
     return error;
 }
 
-TError TClient::ReadRequest(rpc::TContainerRequest &request) {
-    TScopedLock lock(Mutex);
+/*
+ * Output stream which appends into tail of last chunk and then
+ * into new pooled chunks, big responses never get contiguous copy.
+ */
+class TOutputChain : public google::protobuf::io::ZeroCopyOutputStream {
+    static constexpr size_t CHUNK_SIZE = 64 << 10;
+
+    std::list<TClient::TOutputChunk> &Chunks;
+    size_t Remain;
+    google::protobuf::int64 Count = 0;
+
+public:
+    TOutputChain(std::list<TClient::TOutputChunk> &chunks, size_t size) :
+        Chunks(chunks), Remain(size) {}
+
+    bool Next(void **data, int *size) override {
+        if (Chunks.empty() || Chunks.back().Length == Chunks.back().Buffer.Size) {
+            Chunks.emplace_back();
+            Chunks.back().Buffer.Reserve(std::min(std::max(Remain, TBufferPool::MIN_SIZE), CHUNK_SIZE));
+        }
+        auto &chunk = Chunks.back();
+        size_t len = chunk.Buffer.Size - chunk.Length;
+        *data = chunk.Buffer.Data + chunk.Length;
+        *size = len;
+        chunk.Length += len;
+        Remain -= std::min(Remain, len);
+        Count += len;
+        return true;
+    }
 
-    if (Processing) {
-        L_WRN("Client request before response: {}", Id);
-        return TError::Success();
+    void BackUp(int count) override {
+        Chunks.back().Length -= count;
+        if (!Chunks.back().Length)
+            Chunks.pop_back();
+        Count -= count;
     }
 
-    if (Fd < 0)
-        return TError(EError::Unknown, "Connection closed");
+    google::protobuf::int64 ByteCount() const override {
+        return Count;
+    }
+};
+
+/* Returns Queued if buffer has no complete request */
+TError TClient::BufferedRequest() {
+    if (!Length) {
+        if (!Offset)
+            return TError::Queued();
+
+        google::protobuf::io::CodedInputStream input(Buffer.Data, Offset);
 
-    if (Offset >= Buffer.size())
-        Buffer.resize(Offset + 4096);
+        uint32_t length;
+        if (!input.ReadVarint32(&length))
+            return TError::Queued();
 
-    ssize_t len = recv(Fd, &Buffer[Offset], Buffer.size() - Offset, MSG_DONTWAIT);
-    if (len > 0)
-        Offset += len;
-    else if (len == 0)
-        return TError(EError::Unknown, "recv return zero");
-    else if (errno != EAGAIN && errno != EWOULDBLOCK)
-        return TError(EError::Unknown, errno, "recv request failed");
+        if (length > config().daemon().max_msg_len())
+            return TError(EError::Unknown, "oversized request: " + std::to_string(length));
 
-    ActivityTimeMs = GetCurrentTimeMs();
+        Length = length + google::protobuf::io::CodedOutputStream::VarintSize32(length);
+    }
 
-    if (Length && Offset < Length)
+    if (Offset < Length)
         return TError::Queued();
 
-    google::protobuf::io::CodedInputStream input(&Buffer[0], Offset);
+    return TError::Success();
+}
 
-    uint32_t length;
-    if (!input.ReadVarint32(&length))
+/* Must be called under Mutex */
+TError TClient::UpdateEvents() {
+    bool input = !Serial && !Stalled && !Stale &&
+                 Processing < (int)config().daemon().pipeline_depth();
+    uint32_t events = 0;
+
+    if (input)
+        events |= EPOLLIN;
+
+    if (!Output.empty())
+        events |= EPOLLOUT;
+    else if (input && !BufferedRequest())
+        events |= EPOLLOUT; /* socket is writable: kick loop to take buffered requests */
+
+    if (events == Events)
+        return TError::Success();
+
+    Events = events;
+    return Loop->ModifySourceEvents(Fd, events);
+}
+
+TError TClient::ReadRequest(rpc::TContainerRequest &request) {
+    TScopedLock lock(Mutex);
+    TError error;
+
+    if (Fd < 0)
+        return TError(EError::Unknown, "Connection closed");
+
+    /* wait for responses before taking more */
+    if (Serial || Stalled || Processing >= (int)config().daemon().pipeline_depth())
         return TError::Queued();
 
-    if (!Length) {
-        if (length > config().daemon().max_msg_len())
-            return TError(EError::Unknown, "oversized request: " + std::to_string(length));
+    /* identity is shared by executing requests, drain them to recheck it */
+    if (Executing && IdentityChanged()) {
+        Stale = true;
+        error = UpdateEvents();
+        return error ? error : TError::Queued();
+    }
 
-        Length = length + google::protobuf::io::CodedOutputStream::VarintSize32(length);
-        if (Buffer.size() < Length)
-            Buffer.resize(Length + 4096);
+    error = BufferedRequest();
+    if (error.GetError() == EError::Queued) {
+        Buffer.Reserve(std::max(Length, Offset + TBufferPool::MIN_SIZE), Offset);
 
-        if (Offset < Length)
-            return TError::Queued();
+        ssize_t len = recv(Fd, Buffer.Data + Offset, Buffer.Size - Offset, MSG_DONTWAIT);
+        if (len > 0)
+            Offset += len;
+        else if (len == 0)
+            return TError(EError::Unknown, "recv return zero");
+        else if (errno != EAGAIN && errno != EWOULDBLOCK)
+            return TError(EError::Unknown, errno, "recv request failed");
+
+        if (!Offset)
+            Buffer.Release();
+
+        ActivityTimeMs = GetCurrentTimeMs();
+
+        error = BufferedRequest();
     }
+    if (error)
+        return error;
+
+    google::protobuf::io::CodedInputStream input(Buffer.Data, Length);
 
-    if (!request.ParseFromCodedStream(&input))
+    uint32_t length;
+    if (!input.ReadVarint32(&length) || !request.ParseFromCodedStream(&input))
         return TError(EError::Unknown, "cannot parse request");
 
-    if (Offset > Length)
-        return TError(EError::Unknown, "garbage after request");
+    /* untagged request is the only one in flight */
+    if (!request.has_reqid()) {
+        if (Offset > Length)
+            return TError(EError::Unknown, "garbage after request");
+        Serial = true;
+    }
+
+    Offset -= Length;
+    if (Offset)
+        memmove(Buffer.Data, Buffer.Data + Length, Offset);
+    else
+        Buffer.Release();
+    Length = 0;
+
+    Processing++;
+    Executing++;
 
-    Processing = true;
-    return EpollLoop->StopInput(Fd);
+    return UpdateEvents();
 }
 
-TError TClient::SendResponse(bool first) {
+TError TClient::ScheduleDrop() {
     TScopedLock lock(Mutex);
 
     if (Fd < 0)
-        return TError::Success(); /* Connection closed */
-
-    ssize_t len = send(Fd, &Buffer[Offset], Length - Offset, MSG_DONTWAIT);
-    if (len > 0)
-        Offset += len;
-    else if (len == 0) {
-        if (!first)
-            return TError(EError::Unknown, "send return zero");
-    } else if (errno == EPIPE) {
-        L("Client disconnected: {}", Id);
         return TError::Success();
-    } else if (errno != EAGAIN && errno != EWOULDBLOCK)
-        return TError(EError::Unknown, errno, "send response failed");
 
-    ActivityTimeMs = GetCurrentTimeMs();
+    /* fd stays open for the loop, which sees hangup and closes it */
+    Dropping = true;
+    if (shutdown(Fd, SHUT_RDWR))
+        return TError(EError::Unknown, errno, "shutdown()");
+
+    return TError::Success();
+}
+
+TError TClient::StallInput(bool stall) {
+    TScopedLock lock(Mutex);
+
+    if (Fd < 0)
+        return TError(EError::Unknown, "Connection closed");
+
+    Stalled = stall;
+    return UpdateEvents();
+}
+
+/* Must be called under Mutex */
+TError TClient::SendBuffered(bool first) {
+    if (!Output.empty()) {
+        struct iovec iov[64];
+        struct msghdr msg;
+        size_t nr = 0;
+
+        for (auto &chunk: Output) {
+            iov[nr].iov_base = chunk.Buffer.Data + (nr ? 0 : OutOffset);
+            iov[nr].iov_len = chunk.Length - (nr ? 0 : OutOffset);
+            if (++nr == sizeof(iov) / sizeof(iov[0]))
+                break;
+        }
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = nr;
+
+        ssize_t len = sendmsg(Fd, &msg, MSG_DONTWAIT);
+        if (len > 0) {
+            OutOffset += len;
+            while (!Output.empty() && OutOffset >= Output.front().Length) {
+                OutOffset -= Output.front().Length;
+                Output.pop_front();
+            }
+        } else if (len == 0) {
+            if (!first)
+                return TError(EError::Unknown, "send return zero");
+        } else if (errno == EPIPE) {
+            L("Client disconnected: {}", Id);
+            return TError::Success();
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK)
+            return TError(EError::Unknown, errno, "send response failed");
 
-    if (Offset >= Length) {
-        Length = Offset = 0;
-        Processing = false;
-        return EpollLoop->StartInput(Fd);
+        ActivityTimeMs = GetCurrentTimeMs();
     }
 
-    if (first)
-        return EpollLoop->StartOutput(Fd);
+    return UpdateEvents();
+}
 
-    return TError::Success();
+TError TClient::SendResponse(bool first) {
+    TScopedLock lock(Mutex);
+
+    if (Fd < 0)
+        return TError::Success(); /* Connection closed */
+
+    return SendBuffered(first);
 }
 
-TError TClient::QueueResponse(rpc::TContainerResponse &response) {
+TError TClient::QueueResponse(rpc::TContainerResponse &response, bool final) {
     uint32_t length = response.ByteSize();
     size_t lengthSize = google::protobuf::io::CodedOutputStream::VarintSize32(length);
 
-    Offset = 0;
-    Length = lengthSize + length;
+    TScopedLock lock(Mutex);
+
+    if (final) {
+        if (Processing > 0)
+            Processing--;
+        if (!response.has_reqid())
+            Serial = false;
+    }
 
-    if (Buffer.size() < Length)
-        Buffer.resize(Length);
+    if (Fd < 0)
+        return TError::Success(); /* Connection closed */
 
-    google::protobuf::io::CodedOutputStream::WriteVarint32ToArray(length, &Buffer[0]);
-    if (!response.SerializeToArray(&Buffer[lengthSize], length))
-        return TError(EError::Unknown, "cannot serialize response");
+    /* do not pile up pushed responses for client which does not read */
+    if (!final && Output.size() >= MAX_PUSH_CHUNKS)
+        return TError(EError::Busy, "Client output is full");
+
+    /* responses are sent in order of completion */
+    TOutputChain chain(Output, lengthSize + length);
+    {
+        google::protobuf::io::CodedOutputStream output(&chain);
+        output.WriteVarint32(length);
+        response.SerializeWithCachedSizes(&output);
+        if (output.HadError())
+            return TError(EError::Unknown, "cannot serialize response");
+    }
 
-    return SendResponse(true);
+    return SendBuffered(true);
 }
@@ -3,15 +3,21 @@
 #include <string>
 #include <mutex>
 #include <list>
+#include <atomic>
 
 #include "container.hpp"
 #include "common.hpp"
 #include "epoll.hpp"
 #include "util/cred.hpp"
 #include "util/unix.hpp"
+#include "util/buffer.hpp"
 
 #include "fmt/ostream.h"
 
+extern "C" {
+#include <sys/epoll.h>
+}
+
 class TEpollLoop;
 
 namespace rpc {
@@ -27,20 +33,34 @@ public:
     std::string Comm;
     gid_t UserCtGroup = 0;
     std::shared_ptr<TContainer> ClientContainer;
-    std::shared_ptr<TContainer> LockedContainer;
     uint64_t ActivityTimeMs = 0;
-    uint64_t RequestTimeMs = 0;
-    bool Processing = false;
-    bool InEpoll = false;
+    std::atomic<int> Processing; /* requests in flight */
+    std::atomic<int> Executing; /* requests handled by workers right now */
+    std::atomic<bool> Dropping; /* connection is closed by client loop */
+
+    /*
+     * Pipelined requests of one client are handled concurrently,
+     * state of request lives in the worker thread which handles it.
+     */
+    static thread_local std::shared_ptr<TContainer> LockedContainer;
+    static __thread uint64_t RequestTimeMs;
+
+    TEpollLoop *Loop = nullptr; /* client epoll shard */
 
     TClient(int fd);
     TClient(const std::string &special);
     ~TClient();
 
+    /* copy of identity for background operation, see TOperation */
+    std::shared_ptr<TClient> DetachIdentity();
+
     EAccessLevel AccessLevel = EAccessLevel::None;
     std::string PortoNamespace;
     std::string WriteNamespace;
 
+    /* identity is changed by loop thread and read by event delivery */
+    std::mutex IdentityMutex;
+
     bool IsSuperUser(void) const;
 
     bool CanSetUidGid() const;
@@ -52,10 +72,19 @@ public:
 
     void CloseConnection();
 
+    /* shutdown socket, client loop drops connection at hangup */
+    TError ScheduleDrop();
+
     void StartRequest();
     void FinishRequest();
 
+    /* worker is done with request, resumes input held for re-identification */
+    void FinishExecution();
+
     TError IdentifyClient(bool initial);
+
+    /* task moved between containers, recheck identities and pid cache */
+    static void InvalidateIdentity() { IdentityGeneration++; }
     TError ComposeName(const std::string &name, std::string &relative_name) const;
     TError ResolveName(const std::string &relative_name, std::string &name) const;
 
@@ -75,12 +104,17 @@ public:
     TError CanControlPlace(const TPath &place);
 
 
-    std::shared_ptr<TContainerWaiter> Waiter;
+    /* protected with ContainersMutex */
+    std::list<std::shared_ptr<TContainerWaiter>> Waiters;
 
     TError ReadRequest(rpc::TContainerRequest &request);
+
+    /* worker queue is full, stop reading until request is queued */
+    TError StallInput(bool stall);
     bool ReadInterrupted();
 
-    TError QueueResponse(rpc::TContainerResponse &response);
+    /* not final response leaves request in flight, see TNotifyLog */
+    TError QueueResponse(rpc::TContainerResponse &response, bool final = true);
     TError SendResponse(bool first);
 
     std::list<std::weak_ptr<TContainer>> WeakContainers;
@@ -89,9 +123,43 @@ private:
     std::mutex Mutex;
     uint64_t ConnectionTime = 0;
 
+    static std::atomic<uint64_t> IdentityGeneration;
+    uint64_t Generation = 0; /* global plus container generations, see IdentityChanged */
+
+    bool IdentityChanged() const;
+
+    TError IdentifyContainer(std::shared_ptr<TContainer> &ct);
+
+    /* untagged request stops input until response */
+    bool Serial = false;
+    bool Stalled = false;
+
+    /* identity changed while requests are executing, see ReadRequest */
+    bool Stale = false;
+
+    bool Detached = false;
+    uint32_t Events = EPOLLIN;
+
+    /* pooled buffers are released as soon as they become empty */
     uint64_t Length = 0;
     uint64_t Offset = 0;
-    std::vector<uint8_t> Buffer;
+    TPooledBuffer Buffer;
+
+    struct TOutputChunk {
+        TPooledBuffer Buffer;
+        size_t Length = 0;
+    };
+
+    /* responses are serialized right into chunks and sent with sendmsg */
+    std::list<TOutputChunk> Output;
+    static constexpr size_t MAX_PUSH_CHUNKS = 16;
+    uint64_t OutOffset = 0; /* sent from the first chunk */
+
+    friend class TOutputChain;
+
+    TError BufferedRequest();
+    TError SendBuffered(bool first);
+    TError UpdateEvents();
 };
 
 extern TClient SystemClient;
@@ -30,6 +30,9 @@ void TConfig::LoadDefaults() {
 
     config().set_keyvalue_limit(1 << 20);
     config().set_keyvalue_size(32 << 20);
+    config().set_keyvalue_store(false);
+    config().set_keyvalue_store_slot((1 << 20) + (4 << 10));
+    config().set_keyvalue_typed(false);
 
     config().mutable_daemon()->set_max_clients(1000);
     config().mutable_daemon()->set_max_clients_in_container(500);
@@ -46,6 +49,27 @@ void TConfig::LoadDefaults() {
     config().mutable_daemon()->set_portod_start_timeout(60);
     config().mutable_daemon()->set_merge_memory_blkio_controllers(false);
     config().mutable_daemon()->set_client_idle_timeout(60);
+    config().mutable_daemon()->set_io_threads(std::min(GetNumCores(), 4));
+    config().mutable_daemon()->set_read_workers(4);
+    config().mutable_daemon()->set_heavy_workers(8);
+    config().mutable_daemon()->set_client_workers(16);
+    config().mutable_daemon()->set_cgroup_knob_fds(4096);
+    config().mutable_daemon()->set_stat_collector_ms(0);
+    config().mutable_daemon()->set_stat_staleness_ms(10000);
+    config().mutable_daemon()->set_pipeline_depth(16);
+    config().mutable_daemon()->set_event_log_size(10000);
+    config().mutable_daemon()->set_operation_threads(4);
+    config().mutable_daemon()->set_operation_ttl_ms(3600000);
+    config().mutable_daemon()->set_operation_drain_ms(60000);
+    config().mutable_daemon()->set_max_operations(256);
+    config().mutable_daemon()->set_max_client_operations(16);
+    config().mutable_daemon()->set_request_trace(false);
+    config().mutable_daemon()->set_request_trace_size(1000);
+    config().mutable_daemon()->set_request_trace_slowest(20);
+    config().mutable_daemon()->set_log_async(true);
+    config().mutable_daemon()->set_log_binary(false);
+    config().mutable_daemon()->set_restore_threads(std::min(GetNumCores(), 8));
+    config().mutable_daemon()->set_lazy_restore(false);
 
     config().mutable_container()->set_default_aging_time_s(60 * 60 * 24);
     config().mutable_container()->set_respawn_delay_ms(1000);
@@ -5,6 +5,9 @@
 #include <cstdlib>
 #include <algorithm>
 #include <condition_variable>
+#include <set>
+#include <unordered_map>
+#include <thread>
 
 #include "portod.hpp"
 #include "statistics.hpp"
@@ -18,6 +21,7 @@
 #include "network.hpp"
 #include "epoll.hpp"
 #include "kvalue.hpp"
+#include "kv.pb.h"
 #include "volume.hpp"
 #include "util/log.hpp"
 #include "util/string.hpp"
@@ -26,6 +30,8 @@
 #include "client.hpp"
 #include "filesystem.hpp"
 #include "rpc.hpp"
+#include "notify.hpp"
+#include "operation.hpp"
 
 extern "C" {
 #include <sys/types.h>
@@ -39,9 +45,15 @@ extern "C" {
 }
 
 std::mutex ContainersMutex;
-static std::condition_variable ContainersCV;
 std::shared_ptr<TContainer> RootContainer;
 std::map<std::string, std::shared_ptr<TContainer>> Containers;
+/* hash index for lookups, ordered map above serves name ranges */
+static std::unordered_map<std::string, std::shared_ptr<TContainer>> ContainersIndex;
+
+/* Restore and FinishRestore lock containers which are not synced yet */
+static __thread bool Restoring = false;
+static std::condition_variable RestoreCv;
+
 TPath ContainersKV;
 TIdMap ContainerIdMap(1, CONTAINER_ID_MAX);
 
@@ -113,8 +125,8 @@ std::string TContainer::ParentName(const std::string &name) {
 
 std::shared_ptr<TContainer> TContainer::Find(const std::string &name) {
     PORTO_LOCKED(ContainersMutex);
-    auto it = Containers.find(name);
-    if (it == Containers.end())
+    auto it = ContainersIndex.find(name);
+    if (it == ContainersIndex.end())
         return nullptr;
     return it->second;
 }
@@ -146,124 +158,334 @@ TError TContainer::FindTaskContainer(pid_t pid, std::shared_ptr<TContainer> &ct)
     return TContainer::Find(name.substr(prefix.length()), ct);
 }
 
+/*
+ * Hierarchical lock: each container has one lock word with readers, writer,
+ * pending writers and counters of read/write locks held in its subtree:
+ * intents IS and IX. Lock takes intent at each ancestor top-down and then
+ * lock itself, every step is one CAS on one container. Unlock releases
+ * them in one pass and does not touch ContainersMutex if nobody waits.
+ * Acquirers are serialized with ContainersMutex, thus rollback of partial
+ * path happens only due to real conflict.
+ */
+static constexpr uint64_t LOCK_READER = 1ull << 0;
+static constexpr uint64_t LOCK_WRITER = 1ull << 16;
+static constexpr uint64_t LOCK_PENDING = 1ull << 17;
+static constexpr uint64_t LOCK_IS = 1ull << 32;
+static constexpr uint64_t LOCK_IX = 1ull << 48;
+
+static constexpr uint64_t LOCK_READERS_MASK = 0xffffull * LOCK_READER;
+static constexpr uint64_t LOCK_PENDING_MASK = 0x7fffull * LOCK_PENDING;
+static constexpr uint64_t LOCK_IS_MASK = 0xffffull * LOCK_IS;
+static constexpr uint64_t LOCK_IX_MASK = 0xffffull * LOCK_IX;
+
+/* lock mode -> conflicting bits */
+static constexpr uint64_t LOCK_READ_CONFLICT = LOCK_WRITER | LOCK_PENDING_MASK | LOCK_IX_MASK;
+static constexpr uint64_t LOCK_WRITE_CONFLICT = LOCK_READERS_MASK | LOCK_WRITER | LOCK_IS_MASK | LOCK_IX_MASK;
+static constexpr uint64_t LOCK_IS_CONFLICT = LOCK_WRITER | LOCK_PENDING_MASK;
+static constexpr uint64_t LOCK_IX_CONFLICT = LOCK_READERS_MASK | LOCK_WRITER | LOCK_PENDING_MASK;
+
+static bool TryLockWord(std::atomic<uint64_t> &word, uint64_t conflict, uint64_t add) {
+    uint64_t cur = word.load();
+    do {
+        if (cur & conflict)
+            return false;
+    } while (!word.compare_exchange_weak(cur, cur + add));
+    return true;
+}
+
+/*
+ * Lock waiter sleeps in queue of container which blocks it: this container
+ * or ancestor locked in conflicting mode. Unlock wakes only queues along
+ * its parent chain, in FIFO order.
+ */
+struct TLockWaiter {
+    std::condition_variable Cv;
+    TContainer *Blocker = nullptr;
+};
+
+/* Returns blocker or nullptr if locked */
+TContainer *TContainer::TryLockPath(bool for_read) {
+    uint64_t intent = for_read ? LOCK_IS : LOCK_IX;
+    uint64_t conflict = for_read ? LOCK_IS_CONFLICT : LOCK_IX_CONFLICT;
+    TContainer *blocker = nullptr;
+    size_t level;
+
+    for (level = 0; level < LockPath.size(); level++) {
+        if (!TryLockWord(LockPath[level]->LockState, conflict, intent)) {
+            blocker = LockPath[level];
+            break;
+        }
+    }
+
+    if (!blocker) {
+        if (for_read ? TryLockWord(LockState, LOCK_READ_CONFLICT, LOCK_READER) :
+                       TryLockWord(LockState, LOCK_WRITE_CONFLICT, LOCK_WRITER))
+            return nullptr;
+        blocker = this;
+    }
+
+    bool wake = false;
+    while (level--) {
+        LockPath[level]->LockState -= intent;
+        wake |= LockPath[level]->LockWaitersCount > 0;
+    }
+    if (wake)
+        WakeLockWaiters();
+
+    return blocker;
+}
+
+/* Returns true if somebody waits for released locks */
+bool TContainer::ReleaseLockPath(bool for_read) {
+    uint64_t intent = for_read ? LOCK_IS : LOCK_IX;
+    bool wake;
+
+    LockState -= for_read ? LOCK_READER : LOCK_WRITER;
+    wake = LockWaitersCount > 0;
+
+    for (auto ct: LockPath) {
+        ct->LockState -= intent;
+        wake |= ct->LockWaitersCount > 0;
+    }
+
+    return wake;
+}
+
+void TContainer::WakeLockWaiters() {
+    for (auto ct = this; ct; ct = ct->Parent.get())
+        for (auto waiter: ct->LockWaiters)
+            waiter->Cv.notify_one();
+}
+
+static void QueueLockWaiter(TLockWaiter &waiter, TContainer *blocker) {
+    if (waiter.Blocker == blocker)
+        return;
+    if (waiter.Blocker) {
+        waiter.Blocker->LockWaiters.remove(&waiter);
+        waiter.Blocker->LockWaitersCount--;
+    }
+    /* must be visible before next try to lock, pairs with unlock */
+    blocker->LockWaitersCount++;
+    blocker->LockWaiters.push_back(&waiter);
+    waiter.Blocker = blocker;
+}
+
+static void FinishLockWait(TLockWaiter &waiter, uint64_t start) {
+    if (waiter.Blocker) {
+        waiter.Blocker->LockWaiters.remove(&waiter);
+        waiter.Blocker->LockWaitersCount--;
+    }
+    if (start)
+        Statistics->ContainersLockWait.Add(GetCurrentTimeUs() - start);
+}
+
 /* lock subtree for read or write */
 TError TContainer::Lock(TScopedLock &lock, bool for_read, bool try_lock) {
+    TTraceScope trace(TraceLock);
+    TLockWaiter waiter;
+    bool pending = false;
+    uint64_t start = 0;
+
     if (Debug)
         L("{} {} CT{}:{}",
           (try_lock ? "TryLock" : "Lock"),
           (for_read ? "read" : "write"),
           Id, Name);
 
+    /* lazy restore, wait until whole subtree is synced */
+    while (RestorePending && !Restoring && State != EContainerState::Destroyed) {
+        if (try_lock)
+            return TError(EError::Busy, "Container is not restored yet: " + Name);
+        RestoreCv.wait(lock);
+    }
+
     while (1) {
         if (State == EContainerState::Destroyed) {
             if (Debug)
                 L("Lock failed, container CT{}:{} was destroyed", Id, Name);
+            if (pending)
+                LockState -= LOCK_PENDING;
+            FinishLockWait(waiter, 0);
+            /* descendants could wait for our pending write */
+            WakeLockWaiters();
             return TError(EError::ContainerDoesNotExist, "Container was destroyed");
         }
-        bool busy;
-        if (for_read)
-            busy = Locked < 0 || PendingWrite || SubtreeWrite;
-        else
-            busy = Locked || SubtreeRead || SubtreeWrite;
-        for (auto ct = Parent.get(); !busy && ct; ct = ct->Parent.get())
-            busy = ct->PendingWrite || (for_read ? ct->Locked < 0 : ct->Locked);
-        if (!busy)
+        TContainer *blocker = TryLockPath(for_read);
+        if (!blocker)
             break;
         if (try_lock) {
             if (Debug)
                 L("TryLock {} Failed CT{}:{}", (for_read ? "read" : "write"), Id, Name);
             return TError(EError::Busy, "Container is busy: " + Name);
         }
-        if (!for_read)
-            PendingWrite = true;
-        ContainersCV.wait(lock);
+        if (!for_read && !pending) {
+            LockState += LOCK_PENDING;
+            pending = true;
+        }
+        if (!start)
+            start = GetCurrentTimeUs();
+        if (waiter.Blocker != blocker) {
+            /* retry once queued, unlock could miss us before */
+            QueueLockWaiter(waiter, blocker);
+            continue;
+        }
+        waiter.Cv.wait(lock);
     }
-    PendingWrite = false;
-    Locked += for_read ? 1 : -1;
+    if (pending)
+        LockState -= LOCK_PENDING;
+    FinishLockWait(waiter, start);
     LastOwner = GetTid();
-    for (auto ct = Parent.get(); ct; ct = ct->Parent.get()) {
-        if (for_read)
-            ct->SubtreeRead++;
-        else
-            ct->SubtreeWrite++;
-    }
     return TError::Success();
 }
 
 void TContainer::DowngradeLock() {
-    auto lock = LockContainers();
-    PORTO_ASSERT(Locked == -1);
+    PORTO_ASSERT(LockState & LOCK_WRITER);
+    UpdateSubtreeSnapshots();
 
     if (Debug)
         L("Downgrading write to read CT{}:{}", Id, Name);
 
-    for (auto ct = Parent.get(); ct; ct = ct->Parent.get()) {
-        ct->SubtreeRead++;
-        ct->SubtreeWrite--;
+    bool wake = false;
+
+    for (auto ct: LockPath) {
+        ct->LockState += LOCK_IS - LOCK_IX;
+        wake |= ct->LockWaitersCount > 0;
     }
 
-    Locked = 1;
-    ContainersCV.notify_all();
+    LockState += LOCK_READER - LOCK_WRITER;
+    wake |= LockWaitersCount > 0;
+
+    if (wake) {
+        auto lock = LockContainers();
+        WakeLockWaiters();
+    }
 }
 
 void TContainer::UpgradeLock() {
+    TLockWaiter waiter;
+    uint64_t start = 0;
+
     auto lock = LockContainers();
 
     if (Debug)
         L("Upgrading read back to write CT{}:{}", Id, Name);
 
-    PendingWrite = true;
+    LockState += LOCK_PENDING;
+
+    for (auto ct: LockPath)
+        ct->LockState += LOCK_IX - LOCK_IS;
 
-    for (auto ct = Parent.get(); ct; ct = ct->Parent.get()) {
-        ct->SubtreeRead--;
-        ct->SubtreeWrite++;
+    /* wait until we are the only reader, then swap reader into writer */
+    uint64_t cur = LockState;
+    while (1) {
+        if ((cur & LOCK_READERS_MASK) == LOCK_READER && !(cur & LOCK_WRITER)) {
+            if (LockState.compare_exchange_weak(cur, cur - LOCK_READER + LOCK_WRITER - LOCK_PENDING))
+                break;
+            continue;
+        }
+        if (!start)
+            start = GetCurrentTimeUs();
+        if (waiter.Blocker != this)
+            QueueLockWaiter(waiter, this);
+        else
+            waiter.Cv.wait(lock);
+        cur = LockState;
     }
 
-    while (Locked != 1)
-        ContainersCV.wait(lock);
+    FinishLockWait(waiter, start);
 
-    Locked = -1;
     LastOwner = GetTid();
-
-    PendingWrite = false;
 }
 
 void TContainer::Unlock(bool locked) {
+    bool for_read = !(LockState & LOCK_WRITER);
+
     if (Debug)
-        L("Unlock {} CT{}:{}", (Locked > 0 ? "read" : "write"), Id, Name);
-    if (!locked)
-        ContainersMutex.lock();
-    for (auto ct = Parent.get(); ct; ct = ct->Parent.get()) {
-        if (Locked > 0) {
-            PORTO_ASSERT(ct->SubtreeRead > 0);
-            ct->SubtreeRead--;
-        } else {
-            PORTO_ASSERT(ct->SubtreeWrite > 0);
-            ct->SubtreeWrite--;
-        }
+        L("Unlock {} CT{}:{}", (for_read ? "read" : "write"), Id, Name);
+
+    PORTO_ASSERT(LockState & (LOCK_READERS_MASK | LOCK_WRITER));
+
+    /* exclusive lock holder is the only writer, subtree is stable */
+    if (!for_read)
+        UpdateSubtreeSnapshots();
+
+    if (ReleaseLockPath(for_read)) {
+        if (!locked)
+            ContainersMutex.lock();
+        WakeLockWaiters();
+        if (!locked)
+            ContainersMutex.unlock();
     }
-    PORTO_ASSERT(Locked);
-    Locked += (Locked > 0) ? -1 : 1;
-    /* not so effective and fair but simple */
-    ContainersCV.notify_all();
-    if (!locked)
-        ContainersMutex.unlock();
 }
 
 void TContainer::DumpLocks() {
     auto lock = LockContainers();
     for (auto &it: Containers) {
         auto &ct = it.second;
-        if (ct->Locked || ct->PendingWrite || ct->SubtreeRead || ct->SubtreeWrite)
-            L("CT{}:{} Locked {} by {} Read {} Write {}{}", ct->Id, ct->Name, ct->Locked,
-                ct->LastOwner, ct->SubtreeRead, ct->SubtreeWrite,
-                (ct->PendingWrite ? " PendingWrite" : ""));
-    }
+        uint64_t state = ct->LockState;
+        if (state)
+            L("CT{}:{} Readers {} Writer {} by {} PendingWrite {} SubtreeRead {} SubtreeWrite {} Waiters {}",
+                ct->Id, ct->Name, (state & LOCK_READERS_MASK) / LOCK_READER,
+                !!(state & LOCK_WRITER), ct->LastOwner,
+                (state & LOCK_PENDING_MASK) / LOCK_PENDING,
+                (state & LOCK_IS_MASK) / LOCK_IS, (state & LOCK_IX_MASK) / LOCK_IX,
+                ct->LockWaiters.size());
+    }
+}
+
+static const std::set<std::string> SnapshotProperties = {
+    D_STATE,
+    D_ABSOLUTE_NAME,
+    P_OWNER_USER,
+    P_OWNER_GROUP,
+    P_USER,
+    P_GROUP,
+    P_COMMAND,
+    P_PORTO_NAMESPACE,
+    P_WEAK,
+    P_RESPAWN,
+    P_MEM_LIMIT,
+    P_MEM_GUARANTEE,
+    P_ANON_LIMIT,
+    P_DIRTY_LIMIT,
+    P_CPU_POLICY,
+    P_CPU_LIMIT,
+    P_CPU_GUARANTEE,
+    P_IO_POLICY,
+};
+
+bool TContainer::IsSnapshotProperty(const std::string &property) {
+    return SnapshotProperties.count(property);
+}
+
+void TContainer::UpdateSnapshot() {
+    auto snapshot = std::make_shared<TContainerSnapshot>();
+    auto saveCT = CT;
+
+    for (auto &name: SnapshotProperties) {
+        auto &prop = snapshot->Properties[name];
+        prop.first = GetProperty(name, prop.second);
+    }
+
+    CT = saveCT;
+    SnapshotDirty = false;
+
+    std::atomic_store(&Snapshot, std::shared_ptr<const TContainerSnapshot>(snapshot));
+}
+
+/* Parent lock covers state changes in whole subtree */
+void TContainer::UpdateSubtreeSnapshots() {
+    /* lazy restored container gets snapshot once synced */
+    if (SnapshotDirty && !RestoreLazy)
+        UpdateSnapshot();
+    for (auto &child: Children)
+        child->UpdateSubtreeSnapshots();
 }
 
 void TContainer::Register() {
     PORTO_LOCKED(ContainersMutex);
     Containers[Name] = shared_from_this();
+    ContainersIndex[Name] = shared_from_this();
     if (Parent)
         Parent->Children.emplace_back(shared_from_this());
     Statistics->ContainersCreated++;
@@ -272,6 +494,7 @@ void TContainer::Register() {
 void TContainer::Unregister() {
     PORTO_LOCKED(ContainersMutex);
     Containers.erase(Name);
+    ContainersIndex.erase(Name);
     if (Parent)
         Parent->Children.remove(shared_from_this());
 
@@ -286,8 +509,13 @@ TContainer::TContainer(std::shared_ptr<TContainer> parent, int id, const std::st
     Parent(parent), Level(parent ? parent->Level + 1 : 0), Id(id), Name(name),
     FirstName(!parent ? "" : parent->IsRoot() ? name : name.substr(parent->Name.length() + 1)),
     Stdin(0), Stdout(1), Stderr(2),
-    ClientsCount(0), ContainerRequests(0), OomEvents(0)
+    ClientsCount(0), ClientsGeneration(0), ContainerRequests(0), OomEvents(0)
 {
+    LockState = 0;
+    LockWaitersCount = 0;
+    for (auto ct = Parent.get(); ct; ct = ct->Parent.get())
+        LockPath.insert(LockPath.begin(), ct);
+
     Statistics->ContainersCount++;
     RealCreationTime = time(nullptr);
 
@@ -422,7 +650,7 @@ TError TContainer::Create(const std::string &name, std::shared_ptr<TContainer> &
     } else if (name != ROOT_CONTAINER)
         return TError(EError::ContainerDoesNotExist, "parent container not found for " + name);
 
-    if (Containers.find(name) != Containers.end()) {
+    if (Find(name)) {
         error = TError(EError::ContainerAlreadyExists, "container " + name + " already exists");
         goto err;
     }
@@ -468,6 +696,7 @@ TError TContainer::Create(const std::string &name, std::shared_ptr<TContainer> &
     if (error)
         goto err;
 
+    ct->UpdateSnapshot();
     ct->Register();
 
     if (parent)
@@ -484,7 +713,12 @@ err:
     return error;
 }
 
-TError TContainer::Restore(const TKeyValue &kv, std::shared_ptr<TContainer> &ct) {
+/*
+ * Lazy restore registers container and loads metadata, lockers wait
+ * for subtree until FinishRestore syncs state of each container in it.
+ */
+TError TContainer::Restore(const TKeyValue &kv, std::shared_ptr<TContainer> &ct,
+                           bool lazy) {
     TError error;
     int id;
 
@@ -496,7 +730,7 @@ TError TContainer::Restore(const TKeyValue &kv, std::shared_ptr<TContainer> &ct)
 
     auto lock = LockContainers();
 
-    if (Containers.find(kv.Name) != Containers.end())
+    if (Find(kv.Name))
         return TError(EError::ContainerAlreadyExists, kv.Name);
 
     std::shared_ptr<TContainer> parent;
@@ -512,8 +746,16 @@ TError TContainer::Restore(const TKeyValue &kv, std::shared_ptr<TContainer> &ct)
 
     ct->Register();
 
+    if (lazy) {
+        ct->RestoreLazy = true;
+        for (auto p = ct.get(); p; p = p->Parent.get())
+            p->RestorePending++;
+    }
+
     lock.unlock();
 
+    Restoring = true;
+
     error = SystemClient.LockContainer(ct);
     if (error)
         goto err;
@@ -524,29 +766,106 @@ TError TContainer::Restore(const TKeyValue &kv, std::shared_ptr<TContainer> &ct)
 
     ct->RootPath = parent->RootPath / ct->Root;
 
-    ct->SyncState();
+    if (!lazy) {
+        error = ct->RestoreState();
+        if (error)
+            goto err;
+    }
+
+    SystemClient.ReleaseContainer();
+
+    Restoring = false;
+
+    return TError::Success();
+
+err:
+    TNetwork::StopNetwork(*ct);
+    lock.lock();
+    if (lazy) {
+        ct->RestoreLazy = false;
+        for (auto p = ct.get(); p; p = p->Parent.get())
+            p->RestorePending--;
+    }
+    SystemClient.ReleaseContainer(true);
+    ct->Unregister();
+    ct = nullptr;
+    Restoring = false;
+    return error;
+}
+
+/* Second half of lazy restore, drop forgets container without sync */
+TError TContainer::FinishRestore(std::shared_ptr<TContainer> &ct, bool drop) {
+    TError error;
+
+    L_ACT("Sync restored container {}:{}", ct->Id, ct->Name);
+
+    Restoring = true;
+
+    if (drop)
+        error = TError(EError::ContainerDoesNotExist, "Parent container is not restored");
+    else
+        error = SystemClient.LockContainer(ct);
+    if (!error)
+        error = ct->RestoreState();
+    if (error) {
+        TNetwork::StopNetwork(*ct);
+
+        /* volumes are restored and linked before sync, unlink as Destroy does */
+        auto volumes = ct->Volumes;
+        for (auto &volume: volumes) {
+            if (!volume->UnlinkContainer(*ct) && volume->IsDying)
+                volume->Destroy();
+        }
+    }
+
+    auto lock = LockContainers();
+
+    ct->RestoreLazy = false;
+    for (auto p = ct.get(); p; p = p->Parent.get())
+        p->RestorePending--;
+    RestoreCv.notify_all();
+
+    if (error) {
+        SystemClient.ReleaseContainer(true);
+        ct->Unregister();
+        ct = nullptr;
+    } else {
+        lock.unlock();
+        SystemClient.ReleaseContainer();
+    }
+
+    Restoring = false;
+
+    return error;
+}
+
+/* Sync restored container with reality, container must be locked */
+TError TContainer::RestoreState() {
+    TError error;
+
+    SyncState();
 
-    TNetwork::InitClass(*ct);
+    TNetwork::InitClass(*this);
 
     /* Restore cgroups only for running containers */
-    if (ct->State != EContainerState::Stopped &&
-            ct->State != EContainerState::Dead) {
+    if (State != EContainerState::Stopped &&
+            State != EContainerState::Dead) {
 
-        error = TNetwork::RestoreNetwork(*ct);
+        error = TNetwork::RestoreNetwork(*this);
         if (error)
-            goto err;
+            return error;
 
-        error = ct->PrepareCgroups();
+        error = PrepareCgroups();
         if (error)
-            goto err;
+            return error;
 
         /* Kernel without group rt forbids moving RT tasks in to cpu cgroup */
-        if (ct->Task.Pid && !CpuSubsystem.HasRtGroup) {
-            auto cpuCg = ct->GetCgroup(CpuSubsystem);
+        if (Task.Pid && !CpuSubsystem.HasRtGroup) {
+            auto cpuCg = GetCgroup(CpuSubsystem);
             TCgroup cg;
 
-            if (!CpuSubsystem.TaskCgroup(ct->Task.Pid, cg) && cg != cpuCg) {
-                auto freezerCg = ct->GetCgroup(FreezerSubsystem);
+            if (!CpuSubsystem.TaskCgroup(Task.Pid, cg) && cg != cpuCg) {
+                auto freezerCg = GetCgroup(FreezerSubsystem);
                 bool smart;
 
                 /* Disable smart if we're moving tasks into another cgroup */
@@ -573,7 +892,7 @@ TError TContainer::Restore(const TKeyValue &kv, std::shared_ptr<TContainer> &ct)
                 }
 
                 /* Move tasks into correct cpu cgroup before enabling RT */
-                if (!CpuSubsystem.HasRtGroup && ct->SchedPolicy == SCHED_RR) {
+                if (!CpuSubsystem.HasRtGroup && SchedPolicy == SCHED_RR) {
                     error = cpuCg.AttachAll(freezerCg);
                     if (error)
                         L_WRN("Cannot move to corrent cpu cgroup: {}", error);
@@ -582,40 +901,26 @@ TError TContainer::Restore(const TKeyValue &kv, std::shared_ptr<TContainer> &ct)
         }
 
         /* Disable memory guarantee in old cgroup */
-        if (ct->MemGuarantee) {
+        if (MemGuarantee) {
             TCgroup memCg;
-            if (!MemorySubsystem.TaskCgroup(ct->Task.Pid, memCg) &&
-                    memCg != ct->GetCgroup(MemorySubsystem))
+            if (!MemorySubsystem.TaskCgroup(Task.Pid, memCg) &&
+                    memCg != GetCgroup(MemorySubsystem))
                 MemorySubsystem.SetGuarantee(memCg, 0);
         }
 
-        error = ct->ApplyDynamicProperties();
+        error = ApplyDynamicProperties();
         if (error)
-            goto err;
+            return error;
 
-        error = ct->SyncCgroups();
+        error = SyncCgroups();
         if (error)
-            goto err;
+            return error;
     }
 
-    if (ct->MayRespawn())
-        ct->ScheduleRespawn();
-
-    error = ct->Save();
-    if (error)
-        goto err;
-
-    SystemClient.ReleaseContainer();
-
-    return TError::Success();
+    if (MayRespawn())
+        ScheduleRespawn();
 
-err:
-    TNetwork::StopNetwork(*ct);
-    lock.lock();
-    SystemClient.ReleaseContainer(true);
-    ct->Unregister();
-    ct = nullptr;
-    return error;
+    return Save();
 }
 
 std::string TContainer::StateName(EContainerState state) {
@@ -715,6 +1020,19 @@ void TContainer::SetState(EContainerState next) {
     auto lock = LockContainers();
     auto prev = State;
     State = next;
+    SnapshotDirty = true;
+
+    /* counters are not valid across start and stop */
+    std::atomic_store(&Stat, std::shared_ptr<const TContainerStat>());
+
+    NotifyLog.Publish(ENotifyObject::Container, "state", Name, StateName(next));
+
+    /* clients are served only from running containers */
+    if ((prev == EContainerState::Running || prev == EContainerState::Starting ||
+                prev == EContainerState::Meta) &&
+            next != EContainerState::Running && next != EContainerState::Starting &&
+            next != EContainerState::Meta)
+        ClientsGeneration++;
 
     if (prev == EContainerState::Starting || next == EContainerState::Starting) {
         for (auto p = Parent; p; p = p->Parent)
@@ -766,10 +1084,10 @@ TError TContainer::Destroy() {
 
     Unregister();
 
-    TPath path(ContainersKV / std::to_string(Id));
-    error = path.Unlink();
+    TKeyValue node(ContainersKV / std::to_string(Id));
+    error = node.Remove();
     if (error)
-        L_ERR("Can't remove key-value node {}: {}", path, error);
+        L_ERR("Can't remove key-value node {}: {}", node.Path, error);
 
     return TError::Success();
 }
@@ -2426,6 +2744,10 @@ void TContainer::Exit(int status, bool oomKilled) {
         oomKilled = true;
     }
 
+    NotifyLog.Publish(ENotifyObject::Container, "exit", Name, std::to_string(status));
+    if (oomKilled)
+        NotifyLog.Publish(ENotifyObject::Container, "oom", Name);
+
     for (auto &ct: Subtree()) {
         if (ct->State != EContainerState::Stopped &&
                 ct->State != EContainerState::Dead)
@@ -2496,6 +2818,99 @@ void TContainer::SyncPropertiesAll() {
     TNetwork::SyncAllStat();
 }
 
+/* net_* are served from network statistics synced by network watchdog */
+static const std::vector<std::string> StatProperties = {
+    D_MEMORY_USAGE,
+    D_ANON_USAGE,
+    D_CACHE_USAGE,
+    D_MAX_RSS,
+    D_MINOR_FAULTS,
+    D_MAJOR_FAULTS,
+    D_CPU_USAGE,
+    D_CPU_SYSTEM,
+    D_IO_READ,
+    D_IO_WRITE,
+    D_IO_OPS,
+    D_IO_TIME,
+};
+
+static std::thread StatThread;
+static std::condition_variable StatThreadCv;
+static bool StatThreadStop;
+static uint64_t StatCollectorPeriod;
+static uint64_t StatStaleness;
+
+void TContainer::CollectStat() {
+    auto stat = std::make_shared<TContainerStat>();
+
+    /* statistics are read and parsed once for all counters */
+    TCgroupStatContext statContext;
+
+    stat->Values.resize(StatProperties.size());
+    for (unsigned i = 0; i < StatProperties.size(); i++) {
+        auto &val = stat->Values[i];
+        val.first = GetProperty(StatProperties[i], val.second, true);
+    }
+    stat->Time = GetCurrentTimeMs();
+
+    std::atomic_store(&Stat, std::shared_ptr<const TContainerStat>(stat));
+}
+
+void TContainer::StatCollector() {
+    SetProcessName("portod-stat");
+
+    auto lock = LockContainers();
+    while (!StatThreadStop) {
+        std::vector<std::shared_ptr<TContainer>> cts;
+
+        for (auto &it: Containers) {
+            auto &ct = it.second;
+            if (!ct->IsRoot() && (ct->State == EContainerState::Running ||
+                                  ct->State == EContainerState::Meta ||
+                                  ct->State == EContainerState::Paused))
+                cts.push_back(ct);
+        }
+
+        for (auto &ct: cts) {
+            if (StatThreadStop)
+                break;
+            /* never stall behind writers, counters will be refreshed next time */
+            if (ct->LockRead(lock, true))
+                continue;
+            lock.unlock();
+            ct->CollectStat();
+            ct->Unlock();
+            lock = LockContainers();
+        }
+
+        cts.clear();
+
+        if (!StatThreadStop)
+            StatThreadCv.wait_for(lock, std::chrono::milliseconds(StatCollectorPeriod));
+    }
+}
+
+void TContainer::StartStatCollector() {
+    StatCollectorPeriod = config().daemon().stat_collector_ms();
+    StatStaleness = config().daemon().stat_staleness_ms();
+    if (!StatCollectorPeriod)
+        return;
+    if (StatStaleness < StatCollectorPeriod)
+        StatStaleness = StatCollectorPeriod * 2;
+    StatThreadStop = false;
+    StatThread = std::thread(&TContainer::StatCollector);
+}
+
+void TContainer::StopStatCollector() {
+    if (!StatThread.joinable())
+        return;
+    auto lock = LockContainers();
+    StatThreadStop = true;
+    StatThreadCv.notify_all();
+    lock.unlock();
+    StatThread.join();
+}
+
 /* return true if index specified for property */
 static bool ParsePropertyName(std::string &name, std::string &idx) {
     if (name.size() && name.back() == ']') {
@@ -2560,11 +2975,24 @@ TError TContainer::HasProperty(const std::string &property) const {
     return error;
 }
 
-TError TContainer::GetProperty(const std::string &origProperty, std::string &value) const {
+TError TContainer::GetProperty(const std::string &origProperty, std::string &value,
+                               bool sync) const {
     TError error;
     std::string property = origProperty;
     std::string idx;
 
+    if (StatCollectorPeriod && !sync) {
+        auto stat = std::atomic_load(&Stat);
+        if (stat && GetCurrentTimeMs() - stat->Time <= StatStaleness) {
+            auto it = std::find(StatProperties.begin(), StatProperties.end(), property);
+            if (it != StatProperties.end()) {
+                auto &val = stat->Values[it - StatProperties.begin()];
+                value = val.second;
+                return val.first;
+            }
+        }
+    }
+
     if (!ParsePropertyName(property, idx)) {
         auto dot = property.find('.');
 
@@ -2630,6 +3058,7 @@ TError TContainer::SetProperty(const std::string &origProperty,
         return TError(EError::NotSupported, property + " is not supported");
 
     CT = this;
+    SnapshotDirty = true;
 
     std::string oldValue;
     error = prop->Get(oldValue);
@@ -2669,6 +3098,8 @@ TError TContainer::Save(void) {
 
     CT = this;
 
+    bool typed = config().keyvalue_typed();
+
     for (auto knob : ContainerProperties) {
         std::string value;
 
@@ -2676,6 +3107,17 @@ TError TContainer::Save(void) {
         if (knob.second->Prop == EProperty::NONE || !HasProp(knob.second->Prop))
             continue;
 
+        if (typed && knob.second->IsTyped()) {
+            kv::TValue val;
+            knob.second->GetTyped(val);
+            if (!val.SerializeToString(&value)) {
+                error = TError(EError::Unknown, "Cannot serialize " + knob.first);
+                break;
+            }
+            node.SetTyped(knob.first, value);
+            continue;
+        }
+
         error = knob.second->GetToSave(value);
         if (error)
             break;
@@ -2688,7 +3130,10 @@ TError TContainer::Save(void) {
     if (error)
         return error;
 
-    return node.Save();
+    if (!SavedNode)
+        SavedNode = std::make_shared<TKeyValue>(node.Path);
+
+    return node.Update(*SavedNode);
 }
 
 TError TContainer::Load(const TKeyValue &node) {
@@ -2699,9 +3144,16 @@ TError TContainer::Load(const TKeyValue &node) {
 
     OwnerCred = CL->Cred;
 
-    for (auto &kv: node.Data) {
-        std::string key = kv.first;
-        std::string value = kv.second;
+    /* Text and typed values are merged in key order as they were saved */
+    auto text = node.Data.begin();
+    auto typed = node.Typed.begin();
+
+    while (text != node.Data.end() || typed != node.Typed.end()) {
+        bool isTyped = text == node.Data.end() ||
+            (typed != node.Typed.end() && typed->first < text->first);
+        auto &kv = isTyped ? *typed++ : *text++;
+        const std::string &key = kv.first;
+        const std::string &value = kv.second;
 
         if (key == D_STATE) {
             /*
@@ -2722,7 +3174,14 @@ TError TContainer::Load(const TKeyValue &node) {
         }
         auto prop = it->second;
 
-        error = prop->SetFromRestore(value);
+        if (isTyped) {
+            kv::TValue val;
+            if (!val.ParseFromString(value))
+                error = TError(EError::Unknown, "Cannot parse typed value");
+            else
+                error = prop->SetTyped(val);
+        } else
+            error = prop->SetFromRestore(value);
         if (error) {
             L_ERR("Cannot load {} : {}", key, error);
             state = EContainerState::Dead;
@@ -2989,6 +3448,9 @@ TError TContainer::Respawn() {
     RespawnCount++;
     SetProp(EProperty::RESPAWN_COUNT);
 
+    NotifyLog.Publish(ENotifyObject::Container, "respawn", Name,
+                      std::to_string(RespawnCount));
+
     // FIXME
     CL->LockedContainer = shared_from_this();
     error = Start();
@@ -3068,6 +3530,16 @@ void TContainer::Event(const TEvent &event) {
         break;
     }
 
+    case EEventType::OperationTimeout:
+        lock.unlock();
+        TOperation::WaitTimeout(event.Operation.Id, event.Operation.Waiter);
+        break;
+
+    case EEventType::NotifyEvents:
+        lock.unlock();
+        NotifyLog.Deliver();
+        break;
+
     case EEventType::DestroyAgedContainer:
         if (ct) {
             error = ct->Lock(lock);
@@ -3113,6 +3585,13 @@ void TContainer::Event(const TEvent &event) {
     }
 }
 
+uint64_t TContainer::GetClientsGeneration() const {
+    uint64_t sum = 0;
+    for (auto ct = this; ct; ct = ct->Parent.get())
+        sum += ct->ClientsGeneration;
+    return sum;
+}
+
 std::string TContainer::GetPortoNamespace(bool write) const {
     std::string ns;
     for (auto ct = this; ct && !ct->IsRoot() ; ct = ct->Parent.get()) {
@@ -3152,49 +3631,100 @@ void TContainer::CleanupWaiters() {
     }
 }
 
-TContainerWaiter::TContainerWaiter(std::shared_ptr<TClient> client) : Client(client) { }
+TContainerWaiter::TContainerWaiter(std::shared_ptr<TClient> client) :
+    Client(client), StartTimeMs(GetCurrentTimeMs()) { }
 
 void TContainerWaiter::WakeupWaiter(const TContainer *who, bool wildcard) {
     std::shared_ptr<TClient> client = Client.lock();
     if (client) {
         std::string name;
 
-        if (who && client->ComposeName(who->Name, name))
+        client->IdentityMutex.lock();
+        TError error = who ? client->ComposeName(who->Name, name) : TError::Success();
+        client->IdentityMutex.unlock();
+        if (error)
             return;
 
         if (who && wildcard && !MatchWildcard(name))
             return;
 
-        SendWaitResponse(*client, name);
+        SendWaitResponse(*client, *this, name);
 
         Client.reset();
-        client->Waiter = nullptr;
+        client->Waiters.remove_if([this](const std::shared_ptr<TContainerWaiter> &w) {
+                return w.get() == this; });
     }
 }
 
 std::mutex TContainerWaiter::WildcardLock;
-std::list<std::weak_ptr<TContainerWaiter>> TContainerWaiter::WildcardWaiters;
+std::map<std::string, std::list<std::weak_ptr<TContainerWaiter>>> TContainerWaiter::WildcardIndex;
+size_t TContainerWaiter::WildcardInserts = 0;
+size_t TContainerWaiter::WildcardCount = 0;
 
+std::string TContainerWaiter::WildcardPrefix(const std::string &pattern) {
+    return pattern.substr(0, pattern.find_first_of("*?[\\"));
+}
+
+/*
+ * Only buckets keyed by prefixes of the name could match,
+ * thus cost depends on name length and matching waiters.
+ */
 void TContainerWaiter::WakeupWildcard(const TContainer *who) {
+    std::vector<std::shared_ptr<TContainerWaiter>> waiters;
+
     WildcardLock.lock();
-    for (auto &w : WildcardWaiters) {
-        auto waiter = w.lock();
-        if (waiter)
-            waiter->WakeupWaiter(who, true);
+    for (size_t len = 0; len <= who->Name.size(); len++) {
+        auto bucket = WildcardIndex.find(who->Name.substr(0, len));
+        if (bucket == WildcardIndex.end())
+            continue;
+        auto &list = bucket->second;
+        for (auto iter = list.begin(); iter != list.end();) {
+            auto waiter = iter->lock();
+            if (!waiter) {
+                iter = list.erase(iter);
+                continue;
+            }
+            waiters.push_back(waiter);
+            iter++;
+        }
+        if (list.empty())
+            WildcardIndex.erase(bucket);
     }
+
+    for (auto &waiter: waiters)
+        waiter->WakeupWaiter(who, true);
     WildcardLock.unlock();
 }
 
-void TContainerWaiter::AddWildcard(std::shared_ptr<TContainerWaiter> &waiter) {
+void TContainerWaiter::CleanupWildcards() {
+    WildcardCount = 0;
+    for (auto bucket = WildcardIndex.begin(); bucket != WildcardIndex.end();) {
+        bucket->second.remove_if([](const std::weak_ptr<TContainerWaiter> &w) {
+                return w.expired(); });
+        WildcardCount += bucket->second.size();
+        if (bucket->second.empty())
+            bucket = WildcardIndex.erase(bucket);
+        else
+            bucket++;
+    }
+    WildcardInserts = 0;
+}
+
+void TContainerWaiter::AddWildcard(std::shared_ptr<TContainerWaiter> &waiter,
+                                   const std::string &ns) {
+    std::set<std::string> prefixes;
+
+    for (auto &wildcard: waiter->Wildcards)
+        prefixes.insert(ns + WildcardPrefix(wildcard));
+
     WildcardLock.lock();
-    for (auto iter = WildcardWaiters.begin(); iter != WildcardWaiters.end();) {
-        if (iter->expired()) {
-            iter = WildcardWaiters.erase(iter);
-            continue;
-        }
-        iter++;
+    /* amortized sweep of buckets which are never woken */
+    if (WildcardInserts > WildcardCount + 64)
+        CleanupWildcards();
+    for (auto &prefix: prefixes) {
+        WildcardIndex[prefix].push_back(waiter);
+        WildcardInserts++;
     }
-    WildcardWaiters.push_back(waiter);
     WildcardLock.unlock();
 }
 
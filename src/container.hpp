@@ -3,6 +3,7 @@
 #include <string>
 #include <vector>
 #include <list>
+#include <map>
 #include <memory>
 #include <atomic>
 #include <condition_variable>
@@ -16,12 +17,14 @@
 #include "cgroup.hpp"
 #include "property.hpp"
 #include "network.hpp"
+#include "trace.hpp"
 
 class TEpollSource;
 class TCgroup;
 class TSubsystem;
 class TEvent;
 class TContainerWaiter;
+struct TLockWaiter;
 class TClient;
 class TVolume;
 class TKeyValue;
@@ -50,16 +53,34 @@ enum class ECpuSetType {
 
 class TProperty;
 
+/*
+ * Immutable copy of read-mostly properties: state, limits, names, owner.
+ * Published under exclusive lock, read without any container locks.
+ */
+struct TContainerSnapshot {
+    std::map<std::string, std::pair<TError, std::string>> Properties;
+};
+
+/*
+ * Resource counters gathered by background collector, see StatProperties.
+ * Published under read lock, dropped at state change.
+ */
+struct TContainerStat {
+    uint64_t Time;
+    std::vector<std::pair<TError, std::string>> Values;
+};
+
 class TContainer : public std::enable_shared_from_this<TContainer>,
                    public TNonCopyable {
     friend class TProperty;
 
-    int Locked = 0;
-    int SubtreeRead = 0;
-    int SubtreeWrite = 0;
-    bool PendingWrite = false;
+    /* readers, writer, pending writers and subtree intents, see Lock() */
+    std::atomic<uint64_t> LockState;
     pid_t LastOwner = 0;
 
+    /* ancestors from root to parent */
+    std::vector<TContainer *> LockPath;
+
     TFile OomEvent;
 
     /* protected with ContainersMutex */
@@ -67,6 +88,26 @@ class TContainer : public std::enable_shared_from_this<TContainer>,
 
     std::shared_ptr<TEpollSource> Source;
 
+    /* replaced atomically under exclusive lock */
+    std::shared_ptr<const TContainerSnapshot> Snapshot;
+    bool SnapshotDirty = true;
+
+    /* lazy restore, protected with ContainersMutex */
+    bool RestoreLazy = false;   /* metadata loaded, state is not synced yet */
+    int RestorePending = 0;     /* lazy containers in subtree including self */
+
+    void UpdateSnapshot();
+    void UpdateSubtreeSnapshots();
+
+    std::shared_ptr<const TContainerStat> Stat;
+
+    void CollectStat();
+    static void StatCollector();
+
+    TContainer *TryLockPath(bool for_read);
+    bool ReleaseLockPath(bool for_read);
+    void WakeLockWaiters();
+
     // data
     TError UpdateSoftLimit();
     void SetState(EContainerState next);
@@ -114,6 +155,10 @@ public:
     /* protected with ContainersMutex */
     std::list<std::shared_ptr<TContainer>> Children;
 
+    /* protected with ContainersMutex, blocked by this container */
+    std::list<TLockWaiter *> LockWaiters;
+    std::atomic<int> LockWaitersCount;
+
     bool PropSet[(int)EProperty::NR_PROPERTIES];
     bool PropDirty[(int)EProperty::NR_PROPERTIES];
     uint64_t Controllers, RequiredControllers;
@@ -207,6 +252,7 @@ public:
     std::string Private;
     EAccessLevel AccessLevel;
     std::atomic<int> ClientsCount;
+    std::atomic<uint64_t> ClientsGeneration; /* identity of clients inside could change */
     std::atomic<uint64_t> ContainerRequests;
 
     bool IsWeak = false;
@@ -281,6 +327,9 @@ public:
 
     std::string GetPortoNamespace(bool write = false) const;
 
+    /* identity depends on parents too, sum changes when any of them changes */
+    uint64_t GetClientsGeneration() const;
+
     TError Lock(TScopedLock &lock, bool for_read = false, bool try_lock = false);
     TError LockRead(TScopedLock &lock, bool try_lock = false) {
         return Lock(lock, true, try_lock);
@@ -321,8 +370,17 @@ public:
     void SyncProperty(const std::string &name);
     static void SyncPropertiesAll();
 
+    static void StartStatCollector();
+    static void StopStatCollector();
+
+    static bool IsSnapshotProperty(const std::string &property);
+    std::shared_ptr<const TContainerSnapshot> GetSnapshot() const {
+        return std::atomic_load(&Snapshot);
+    }
+
     TError HasProperty(const std::string &property) const;
-    TError GetProperty(const std::string &property, std::string &value) const;
+    TError GetProperty(const std::string &property, std::string &value,
+                       bool sync = false) const;
     TError SetProperty(const std::string &property, const std::string &value);
 
     void ForgetPid();
@@ -330,6 +388,9 @@ public:
     TError Seize();
     TError SyncCgroups();
 
+    /* last saved state, storage gets only changes */
+    std::shared_ptr<TKeyValue> SavedNode;
+
     TError Save(void);
     TError Load(const TKeyValue &node);
 
@@ -358,7 +419,10 @@ public:
     static TError FindTaskContainer(pid_t pid, std::shared_ptr<TContainer> &ct);
 
     static TError Create(const std::string &name, std::shared_ptr<TContainer> &ct);
-    static TError Restore(const TKeyValue &kv, std::shared_ptr<TContainer> &ct);
+    static TError Restore(const TKeyValue &kv, std::shared_ptr<TContainer> &ct,
+                          bool lazy = false);
+    static TError FinishRestore(std::shared_ptr<TContainer> &ct, bool drop = false);
+    TError RestoreState();
 
     static void Event(const TEvent &event);
 };
@@ -366,16 +430,26 @@ public:
 class TContainerWaiter {
 private:
     static std::mutex WildcardLock;
-    static std::list<std::weak_ptr<TContainerWaiter>> WildcardWaiters;
+    /* absolute name prefix before first wildcard -> waiters */
+    static std::map<std::string, std::list<std::weak_ptr<TContainerWaiter>>> WildcardIndex;
+    static size_t WildcardInserts;
+    static size_t WildcardCount;
+    static void CleanupWildcards();
     std::weak_ptr<TClient> Client;
 public:
     TContainerWaiter(std::shared_ptr<TClient> client);
     void WakeupWaiter(const TContainer *who, bool wildcard = false);
     static void WakeupWildcard(const TContainer *who);
-    static void AddWildcard(std::shared_ptr<TContainerWaiter> &waiter);
+    static void AddWildcard(std::shared_ptr<TContainerWaiter> &waiter,
+                            const std::string &ns);
+    static std::string WildcardPrefix(const std::string &pattern);
 
     std::vector<std::string> Wildcards;
     bool MatchWildcard(const std::string &name);
+
+    uint64_t StartTimeMs;
+    bool Pipelined = false;
+    uint64_t RequestId = 0;
 };
 
 extern std::mutex ContainersMutex;
@@ -385,6 +459,7 @@ extern TPath ContainersKV;
 extern TIdMap ContainerIdMap;
 
 static inline std::unique_lock<std::mutex> LockContainers() {
+    TTraceScope trace(TraceLock);
     return std::unique_lock<std::mutex>(ContainersMutex);
 }
 
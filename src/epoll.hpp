@@ -31,9 +31,9 @@ class TEpollLoop : public TLockable, public TNonCopyable {
 
     std::vector<std::weak_ptr<TEpollSource>> Sources;
 
+public:
     TError ModifySourceEvents(int fd, uint32_t events) const;
 
-public:
     TError Create();
     void Destroy();
     ~TEpollLoop();
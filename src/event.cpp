@@ -63,10 +63,14 @@ std::string TEvent::GetMsg() const {
             return "OOM";
         case EEventType::WaitTimeout:
             return "wait timeout";
+        case EEventType::OperationTimeout:
+            return "operation " + std::to_string(Operation.Id) + " wait timeout";
         case EEventType::DestroyAgedContainer:
             return "destroy aged container";
         case EEventType::DestroyWeakContainer:
             return "destroy weak container";
+        case EEventType::NotifyEvents:
+            return "notify events";
         default:
             return "unknown event";
     }
@@ -15,8 +15,10 @@ enum class EEventType {
     Respawn,
     OOM,
     WaitTimeout,
+    OperationTimeout,
     DestroyAgedContainer,
     DestroyWeakContainer,
+    NotifyEvents,
 };
 
 class TEventWorker;
@@ -35,6 +37,11 @@ public:
         std::weak_ptr<TContainerWaiter> Waiter;
     } WaitTimeout;
 
+    struct {
+        uint64_t Id = 0;
+        uint64_t Waiter = 0;
+    } Operation;
+
     uint64_t DueMs = 0;
 
     TEvent(EEventType type, std::shared_ptr<TContainer> container = nullptr) :
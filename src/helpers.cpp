@@ -1,8 +1,10 @@
 #include "helpers.hpp"
 #include "common.hpp"
+#include "operation.hpp"
 #include "util/path.hpp"
 #include "util/log.hpp"
 #include "util/unix.hpp"
+#include "util/string.hpp"
 
 extern "C" {
 #include <unistd.h>
@@ -38,6 +40,17 @@ TError RunCommand(const std::vector<std::string> &command, const TPath &cwd,
         return error;
 
     if (task.Pid) {
+        auto op = TOperation::Current;
+
+        /* account progress of async operation before reaping helper */
+        if (op) {
+            siginfo_t info;
+
+            op->StartHelper(task.Pid);
+            while (waitid(P_PID, task.Pid, &info, WEXITED | WNOWAIT) && errno == EINTR);
+            op->FinishHelper(task.Pid);
+        }
+
         error = task.Wait();
         if (error) {
             char buf[2048];
@@ -92,9 +105,17 @@ TError RunCommand(const std::vector<std::string> &command, const TPath &cwd,
 }
 
 TError CopyRecursive(const TPath &src, const TPath &dst) {
-    return RunCommand({ "cp", "--archive", "--force",
-                        "--one-file-system", "--no-target-directory",
-                        src.ToString(), "." }, dst);
+    TTuple args = { "cp", "--archive", "--force",
+                    "--one-file-system", "--no-target-directory",
+                    src.ToString(), "." };
+
+    /* listing of copied files is progress of async operation */
+    if (TOperation::Current && TOperation::Current->Listing.Fd >= 0) {
+        args.insert(args.begin() + 1, "--verbose");
+        return RunCommand(args, dst, TFile(), TOperation::Current->Listing);
+    }
+
+    return RunCommand(args, dst);
 }
 
 TError ClearRecursive(const TPath &path) {
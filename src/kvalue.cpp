@@ -1,33 +1,343 @@
+#include <unordered_map>
+#include <memory>
+
 #include "kvalue.hpp"
 #include "config.hpp"
+#include "trace.hpp"
 #include "kv.pb.h"
 #include "protobuf.hpp"
 #include "util/log.hpp"
+#include "util/locks.hpp"
+#include "util/crc32.hpp"
 
 extern "C" {
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
+}
+
+#define KV_STORE_NAME       ".store"
+#define KV_STORE_MAGIC      0x53564b50 /* "PKVS" */
+#define KV_SLOT_MAGIC       0x544f4c53 /* "SLOT" */
+#define KV_STORE_VERSION    1
+#define KV_STORE_HEADER     4096
+#define KV_STORE_GROW       64
+
+struct TKeyValueStoreHeader {
+    uint32_t Magic;
+    uint32_t Version;
+    uint32_t SlotSize;
+    uint32_t Reserved;
+} __attribute__((packed));
+
+/* followed by name and packed node, checksum covers all after itself */
+struct TKeyValueSlot {
+    uint32_t Magic;
+    uint32_t Crc;
+    uint64_t Gen;
+    uint32_t NameLen;
+    uint32_t DataLen;
+} __attribute__((packed));
+
+/*
+ * All nodes of kv root in one memory-mapped file. Each node owns pair of
+ * slots: update is written into older slot and supersedes the other one
+ * only when its checksum matches, thus torn write leaves previous version.
+ */
+class TKeyValueStore : public TLockable, public TNonCopyable {
+    TFile File;
+    char *Map = nullptr;
+    uint64_t MapSize = 0;
+    uint32_t SlotSize = 0;
+    uint32_t Pairs = 0;
+    std::unordered_map<std::string, uint32_t> Index;
+    std::vector<uint32_t> FreePairs;
+
+    TKeyValueSlot *Slot(uint32_t pair, int nr) {
+        return (TKeyValueSlot *)(Map + KV_STORE_HEADER +
+                (uint64_t)(pair * 2 + nr) * SlotSize);
+    }
+
+    bool Valid(const TKeyValueSlot *slot) const {
+        if (slot->Magic != KV_SLOT_MAGIC ||
+                sizeof(*slot) + (uint64_t)slot->NameLen + slot->DataLen > SlotSize)
+            return false;
+        const char *ptr = (const char *)slot + offsetof(TKeyValueSlot, Gen);
+        size_t len = sizeof(*slot) - offsetof(TKeyValueSlot, Gen) +
+                     slot->NameLen + slot->DataLen;
+        return Crc32(ptr, len) == slot->Crc;
+    }
+
+    /* returns current slot of pair or null */
+    TKeyValueSlot *Current(uint32_t pair) {
+        TKeyValueSlot *a = Slot(pair, 0), *b = Slot(pair, 1);
+        bool va = Valid(a), vb = Valid(b);
+        if (va && vb)
+            return a->Gen > b->Gen ? a : b;
+        return va ? a : vb ? b : nullptr;
+    }
+
+    TError Grow();
+
+public:
+    const TPath Path;
+
+    TKeyValueStore(const TPath &path) : Path(path) { }
+    ~TKeyValueStore() {
+        if (Map)
+            munmap(Map, MapSize);
+    }
+
+    TError Open(bool create);
+    TError Read(const std::string &name, std::string &data);
+    TError Write(const std::string &name, const std::string &data);
+    TError Remove(const std::string &name);
+    void List(std::vector<std::string> &names);
+};
+
+/* slot must fit node of any allowed size */
+static TError CheckSlotSize(uint32_t size) {
+    if (size < config().keyvalue_limit() + sizeof(TKeyValueSlot) + NAME_MAX)
+        return TError(EError::InvalidValue, "KeyValue: store slot " +
+                      std::to_string(size) + " cannot fit keyvalue_limit " +
+                      std::to_string(config().keyvalue_limit()) + " and slot header");
+    return TError::Success();
+}
+
+TError TKeyValueStore::Open(bool create) {
+    TKeyValueStoreHeader hdr;
+    struct stat st;
+    TError error;
+
+    error = File.Create(Path, O_RDWR | O_CLOEXEC | (create ? O_CREAT : 0), 0640);
+    if (error)
+        return error;
+
+    error = File.Stat(st);
+    if (error)
+        return error;
+
+    if (!st.st_size) {
+        hdr.Magic = KV_STORE_MAGIC;
+        hdr.Version = KV_STORE_VERSION;
+        hdr.SlotSize = config().keyvalue_store_slot();
+        hdr.Reserved = 0;
+
+        if (!hdr.SlotSize || hdr.SlotSize % KV_STORE_HEADER)
+            return TError(EError::InvalidValue, "KeyValue: slot size must be multiple of page");
+
+        error = CheckSlotSize(hdr.SlotSize);
+        if (error)
+            return error;
+
+        if (pwrite(File.Fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+                ftruncate(File.Fd, KV_STORE_HEADER))
+            return TError(EError::Unknown, errno, "KeyValue: cannot init store " + Path.ToString());
+
+        error = File.Chown(RootUser, PortoGroup);
+        if (error)
+            return error;
+
+        st.st_size = KV_STORE_HEADER;
+    } else if (pread(File.Fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+               hdr.Magic != KV_STORE_MAGIC || hdr.Version != KV_STORE_VERSION ||
+               !hdr.SlotSize || hdr.SlotSize % KV_STORE_HEADER) {
+        return TError(EError::Unknown, "KeyValue: corrupted store " + Path.ToString());
+    }
+
+    /* slot size is kept from creation */
+    if (create) {
+        error = CheckSlotSize(hdr.SlotSize);
+        if (error)
+            return error;
+    }
+
+    SlotSize = hdr.SlotSize;
+    Pairs = (st.st_size - KV_STORE_HEADER) / SlotSize / 2;
+    MapSize = KV_STORE_HEADER + (uint64_t)Pairs * 2 * SlotSize;
+
+    Map = (char *)mmap(nullptr, MapSize, PROT_READ | PROT_WRITE, MAP_SHARED, File.Fd, 0);
+    if (Map == MAP_FAILED) {
+        Map = nullptr;
+        return TError(EError::Unknown, errno, "KeyValue: cannot map store " + Path.ToString());
+    }
+
+    /* single sequential pass */
+    for (uint32_t pair = Pairs; pair-- > 0; ) {
+        auto slot = Current(pair);
+        if (!slot) {
+            FreePairs.push_back(pair);
+            continue;
+        }
+
+        std::string name((char *)(slot + 1), slot->NameLen);
+        auto it = Index.find(name);
+        if (it != Index.end()) {
+            L_WRN("KeyValue: duplicate node {} in store", name);
+            auto other = Current(it->second);
+            if (other->Gen > slot->Gen) {
+                Slot(pair, 0)->Magic = Slot(pair, 1)->Magic = 0;
+                FreePairs.push_back(pair);
+                continue;
+            }
+            Slot(it->second, 0)->Magic = Slot(it->second, 1)->Magic = 0;
+            FreePairs.push_back(it->second);
+        }
+
+        Index[name] = pair;
+    }
+
+    return TError::Success();
+}
+
+TError TKeyValueStore::Grow() {
+    uint32_t pairs = Pairs + std::max(Pairs, (uint32_t)KV_STORE_GROW);
+    uint64_t size = KV_STORE_HEADER + (uint64_t)pairs * 2 * SlotSize;
+
+    /* tmpfs allocates only touched pages */
+    if (ftruncate(File.Fd, size))
+        return TError(EError::ResourceNotAvailable, errno, "KeyValue: cannot grow store");
+
+    void *map = mremap(Map, MapSize, size, MREMAP_MAYMOVE);
+    if (map == MAP_FAILED)
+        return TError(EError::ResourceNotAvailable, errno, "KeyValue: cannot remap store");
+
+    Map = (char *)map;
+    MapSize = size;
+
+    for (uint32_t pair = pairs; pair-- > Pairs; )
+        FreePairs.push_back(pair);
+    Pairs = pairs;
+
+    return TError::Success();
+}
+
+TError TKeyValueStore::Read(const std::string &name, std::string &data) {
+    auto lock = ScopedLock();
+
+    auto it = Index.find(name);
+    if (it == Index.end())
+        return TError(EError::Unknown, ENOENT, "KeyValue: node " + name + " not found");
+
+    auto slot = Current(it->second);
+    if (!slot)
+        return TError(EError::Unknown, "KeyValue: node " + name + " is corrupted");
+
+    data.assign((char *)(slot + 1) + slot->NameLen, slot->DataLen);
+
+    return TError::Success();
+}
+
+TError TKeyValueStore::Write(const std::string &name, const std::string &data) {
+    TKeyValueSlot *cur = nullptr, *slot;
+    uint32_t pair;
+    TError error;
+
+    if (sizeof(*slot) + name.size() + data.size() > SlotSize)
+        return TError(EError::Unknown, "KeyValue: object too big for store slot");
+
+    auto lock = ScopedLock();
+
+    auto it = Index.find(name);
+    if (it != Index.end()) {
+        pair = it->second;
+        cur = Current(pair);
+    } else {
+        if (FreePairs.empty()) {
+            error = Grow();
+            if (error)
+                return error;
+        }
+        pair = FreePairs.back();
+        FreePairs.pop_back();
+        Index[name] = pair;
+    }
+
+    slot = Slot(pair, cur == Slot(pair, 0) ? 1 : 0);
+
+    slot->Magic = 0;
+    slot->Gen = cur ? cur->Gen + 1 : 1;
+    slot->NameLen = name.size();
+    slot->DataLen = data.size();
+    memcpy(slot + 1, name.c_str(), name.size());
+    memcpy((char *)(slot + 1) + name.size(), data.c_str(), data.size());
+
+    const char *ptr = (const char *)slot + offsetof(TKeyValueSlot, Gen);
+    size_t len = sizeof(*slot) - offsetof(TKeyValueSlot, Gen) + name.size() + data.size();
+    slot->Crc = Crc32(ptr, len);
+    slot->Magic = KV_SLOT_MAGIC;
+
+    return TError::Success();
+}
+
+TError TKeyValueStore::Remove(const std::string &name) {
+    auto lock = ScopedLock();
+
+    auto it = Index.find(name);
+    if (it == Index.end())
+        return TError(EError::Unknown, ENOENT, "KeyValue: node " + name + " not found");
+
+    Slot(it->second, 0)->Magic = 0;
+    Slot(it->second, 1)->Magic = 0;
+    FreePairs.push_back(it->second);
+    Index.erase(it);
+
+    return TError::Success();
+}
+
+void TKeyValueStore::List(std::vector<std::string> &names) {
+    auto lock = ScopedLock();
+
+    for (auto &it: Index)
+        names.push_back(it.first);
+}
+
+/* filled by Mount at start, read-only later */
+static std::map<std::string, std::unique_ptr<TKeyValueStore>> Stores;
+
+static TKeyValueStore *FindStore(const TPath &root) {
+    auto it = Stores.find(root.ToString());
+    return it == Stores.end() ? nullptr : it->second.get();
 }
 
 TError TKeyValue::Load() {
+    auto store = FindStore(Path.DirName());
     std::string buf;
     kv::TNode node;
     TError error;
 
-    error = Path.ReadAll(buf, config().keyvalue_limit());
+    if (store)
+        error = store->Read(Path.BaseName(), buf);
+    else
+        error = Path.ReadAll(buf, config().keyvalue_limit());
     if (error)
         return error;
 
     ssize_t size = buf.size();
     google::protobuf::io::CodedInputStream input((uint8_t *)&buf[0], size);
 
+    BaseSize = 0;
+    Size = 0;
+
     while (size) {
         uint32_t len;
 
-        if (!input.ReadVarint32(&len))
+        bool torn = !input.ReadVarint32(&len);
+        if (!torn) {
+            size -= google::protobuf::io::CodedOutputStream::VarintSize32(len);
+            torn = (ssize_t)len > size;
+        }
+
+        /* delta append was interrupted, next update rewrites storage */
+        if (torn && Size) {
+            L_WRN("KeyValue: torn delta in {}, {} bytes ignored", Path, buf.size() - Size);
+            Size = 0;
+            break;
+        }
+
+        if (torn)
             return TError(EError::Unknown, "KeyValue: corrupted storage");
 
-        size -= google::protobuf::io::CodedOutputStream::VarintSize32(len);
         size -= len;
 
         node.Clear();
@@ -38,14 +348,42 @@ TError TKeyValue::Load() {
             return TError(EError::Unknown, "KeyValue: corrupted record");
         input.PopLimit(limit);
 
-        for (const auto &pair: node.pairs())
-            Data[pair.key()] = pair.val();
+        for (const auto &pair: node.pairs()) {
+            if (pair.has_value())
+                SetTyped(pair.key(), pair.value());
+            else
+                Set(pair.key(), pair.val());
+        }
+
+        for (const auto &key: node.deleted())
+            Del(key);
+
+        Size = buf.size() - size;
+        if (!BaseSize)
+            BaseSize = Size;
     }
 
     return TError::Success();
 }
 
+TError TKeyValue::Pack(const kv::TNode &node, std::string &buf) {
+    uint32_t len = node.ByteSize();
+    size_t lenLen = google::protobuf::io::CodedOutputStream::VarintSize32(len);
+
+    if (len + lenLen > config().keyvalue_limit())
+        return TError(EError::Unknown, "KeyValue: object too big");
+
+    buf.resize(len + lenLen);
+
+    google::protobuf::io::CodedOutputStream::WriteVarint32ToArray(len, (uint8_t *)&buf[0]);
+    if (!node.SerializeToArray((uint8_t *)&buf[lenLen], len))
+        return TError(EError::Unknown, "KeyValue: cannot serialize");
+
+    return TError::Success();
+}
+
 TError TKeyValue::Save() {
+    TTraceScope trace(TraceKv);
     std::string buf;
     kv::TNode node;
     TError error;
@@ -56,17 +394,24 @@ TError TKeyValue::Save() {
         kv->set_val(pair.second);
     }
 
-    uint32_t len = node.ByteSize();
-    size_t lenLen = google::protobuf::io::CodedOutputStream::VarintSize32(len);
-
-    if (len + lenLen > config().keyvalue_limit())
-        return TError(EError::Unknown, "KeyValue: object too big");
+    for (const auto &pair: Typed) {
+        auto kv = node.add_pairs();
+        kv->set_key(pair.first);
+        kv->set_val("");
+        kv->set_value(pair.second);
+    }
 
-    buf.resize(len + lenLen);
+    error = Pack(node, buf);
+    if (error)
+        return error;
 
-    google::protobuf::io::CodedOutputStream::WriteVarint32ToArray(len, (uint8_t *)&buf[0]);
-    if (!node.SerializeToArray((uint8_t *)&buf[lenLen], len))
-        return TError(EError::Unknown, "KeyValue: cannot serialize");
+    auto store = FindStore(Path.DirName());
+    if (store) {
+        error = store->Write(Path.BaseName(), buf);
+        if (!error)
+            BaseSize = Size = buf.size();
+        return error;
+    }
 
     TPath tmpPath(Path.ToString() + ".tmp");
     error = tmpPath.Mkfile(0640);
@@ -79,10 +424,108 @@ TError TKeyValue::Save() {
 
     if (error)
         (void)tmpPath.Unlink();
+    else
+        BaseSize = Size = buf.size();
 
     return error;
 }
 
+/*
+ * Appends changes against last saved state. Storage is rewritten from
+ * scratch once deltas outgrow full node or page of tmpfs, whichever
+ * is bigger: thus it takes at most twice more space. Deletions are
+ * rewritten too, deltas stay readable by older versions.
+ */
+TError TKeyValue::Update(TKeyValue &saved) {
+    std::string buf;
+    kv::TNode node;
+    TError error;
+
+    if (!saved.Size)
+        goto rewrite;
+
+    /* store rewrites node in place */
+    if (FindStore(Path.DirName())) {
+        if (Data == saved.Data && Typed == saved.Typed)
+            return TError::Success();
+        goto rewrite;
+    }
+
+    for (const auto &pair: Data) {
+        auto it = saved.Data.find(pair.first);
+        if (it == saved.Data.end() || it->second != pair.second) {
+            auto kv = node.add_pairs();
+            kv->set_key(pair.first);
+            kv->set_val(pair.second);
+        }
+    }
+
+    for (const auto &pair: Typed) {
+        auto it = saved.Typed.find(pair.first);
+        if (it == saved.Typed.end() || it->second != pair.second) {
+            auto kv = node.add_pairs();
+            kv->set_key(pair.first);
+            kv->set_val("");
+            kv->set_value(pair.second);
+        }
+    }
+
+    /* older versions ignore deleted keys in deltas, they would come back */
+    for (const auto &pair: saved.Data) {
+        if (!Has(pair.first))
+            goto rewrite;
+    }
+
+    for (const auto &pair: saved.Typed) {
+        if (!Has(pair.first))
+            goto rewrite;
+    }
+
+    if (!node.pairs_size())
+        return TError::Success();
+
+    error = Pack(node, buf);
+    if (error)
+        return error;
+
+    if (saved.Size - saved.BaseSize + buf.size() >
+            std::max(saved.BaseSize, (uint64_t)getpagesize()) ||
+            saved.Size + buf.size() > config().keyvalue_limit())
+        goto rewrite;
+
+    {
+        TTraceScope trace(TraceKv);
+        TFile file;
+
+        error = file.OpenAppend(Path);
+        if (!error)
+            error = file.WriteAll(buf);
+    }
+
+    /* partially written delta is overwritten too */
+    if (error) {
+        L_WRN("KeyValue: cannot append delta to {}: {}", Path, error);
+        goto rewrite;
+    }
+
+    BaseSize = saved.BaseSize;
+    Size = saved.Size + buf.size();
+    goto out;
+
+rewrite:
+    error = Save();
+    if (error)
+        return error;
+
+out:
+    saved.Data = Data;
+    saved.Typed = Typed;
+    saved.BaseSize = BaseSize;
+    saved.Size = Size;
+
+    return TError::Success();
+}
+
 TError TKeyValue::Mount(const TPath &root) {
     TError error;
     TMount mount;
@@ -110,33 +553,134 @@ TError TKeyValue::Mount(const TPath &root) {
 
     std::vector<std::string> names;
     error = root.ReadDirectory(names);
-    if (!error) {
-        for (auto &name : names) {
-            if (StringEndsWith(name, ".tmp"))
-                (void)(root / name).Unlink();
+    if (error)
+        return error;
+
+    std::list<TKeyValue> nodes;
+
+    for (auto &name : names) {
+        if (StringEndsWith(name, ".tmp"))
+            (void)(root / name).Unlink();
+        else if (name != KV_STORE_NAME)
+            nodes.emplace_back(root / name);
+    }
+
+    TPath storePath = root / KV_STORE_NAME;
+
+    if (config().keyvalue_store()) {
+        /* import nodes left by file backend */
+        for (auto &node: nodes) {
+            TError err = node.Load();
+            if (err)
+                L_WRN("Cannot load {}: {}", node.Path, err);
         }
+
+        error = OpenStore(root, true);
+        if (error)
+            return error;
+
+        /* file is kept if import fails, it is picked again at next mount */
+        for (auto &node: nodes) {
+            if (!node.Size)
+                continue;
+            TError err = node.Save();
+            if (err)
+                L_ERR("Cannot import {} into store: {}", node.Path, err);
+            else
+                (void)node.Path.Unlink();
+        }
+    } else if (storePath.Exists()) {
+        /* export nodes into files and drop store */
+        error = OpenStore(root, false);
+        if (error)
+            return error;
+
+        nodes.clear();
+        (void)ListAll(root, nodes);
+        for (auto &node: nodes) {
+            TError err = node.Load();
+            if (err)
+                L_WRN("Cannot load {}: {}", node.Path, err);
+        }
+
+        auto store = std::move(Stores[root.ToString()]);
+        Stores.erase(root.ToString());
+
+        bool exported = true;
+        for (auto &node: nodes) {
+            if (!node.Size)
+                continue;
+            TError err = node.Save();
+            if (err) {
+                L_ERR("Cannot export {} from store: {}", node.Path, err);
+                exported = false;
+            }
+        }
+
+        /* keep serving from store until every node is exported */
+        if (!exported) {
+            L_WRN("KeyValue: keep store {} till next mount", storePath);
+            Stores[root.ToString()] = std::move(store);
+            return TError::Success();
+        }
+
+        error = storePath.Unlink();
     }
 
     return error;
 }
 
+TError TKeyValue::OpenStore(const TPath &root, bool create) {
+    std::unique_ptr<TKeyValueStore> store(new TKeyValueStore(root / KV_STORE_NAME));
+    TError error = store->Open(create);
+    if (!error)
+        Stores[root.ToString()] = std::move(store);
+    return error;
+}
+
 TError TKeyValue::ListAll(const TPath &root, std::list<TKeyValue> &nodes) {
     std::vector<std::string> names;
-    TError error = root.ReadDirectory(names);
+    TError error;
+
+    auto store = FindStore(root);
+    if (store)
+        store->List(names);
+    else
+        error = root.ReadDirectory(names);
+
     if (!error) {
         for (auto &name : names) {
-            if (!StringEndsWith(name, ".tmp"))
+            if (!StringEndsWith(name, ".tmp") && name != KV_STORE_NAME)
                 nodes.emplace_back(root / name);
         }
     }
     return error;
 }
 
+TError TKeyValue::Remove() {
+    auto store = FindStore(Path.DirName());
+    if (store)
+        return store->Remove(Path.BaseName());
+    return Path.Unlink();
+}
+
 void TKeyValue::DumpAll(const TPath &root) {
     std::vector<std::string> names;
     TError error;
 
-    error = root.ReadDirectory(names);
+    if ((root / KV_STORE_NAME).Exists() && !FindStore(root)) {
+        error = OpenStore(root, false);
+        if (error) {
+            L("ERROR {}", error);
+            return;
+        }
+    }
+
+    auto store = FindStore(root);
+    if (store)
+        store->List(names);
+    else
+        error = root.ReadDirectory(names);
     if (error) {
         L("ERROR {}", error);
         return;
@@ -158,5 +702,13 @@ void TKeyValue::DumpAll(const TPath &root) {
 
         for (auto &kv: node.Data)
             L("{} = {} ", kv.first, kv.second);
+
+        for (auto &kv: node.Typed) {
+            kv::TValue value;
+            if (value.ParseFromString(kv.second))
+                L("{} = <{}>", kv.first, value.ShortDebugString());
+            else
+                L("{} = <corrupted>", kv.first);
+        }
     }
 }
@@ -6,11 +6,24 @@
 #include "common.hpp"
 #include "util/path.hpp"
 
+namespace kv {
+    class TNode;
+}
+
 class TKeyValue {
+    static TError Pack(const kv::TNode &node, std::string &buf);
+    static TError OpenStore(const TPath &root, bool create);
+
 public:
     const TPath Path;
     std::string Name;
     std::map<std::string, std::string> Data;
+    /* serialized kv::TValue, key is either here or in Data */
+    std::map<std::string, std::string> Typed;
+
+    /* bytes in storage: full node and deltas appended after it */
+    uint64_t BaseSize = 0;
+    uint64_t Size = 0;
 
     TKeyValue(const TPath &path) : Path(path) { }
 
@@ -19,7 +32,7 @@ public:
     }
 
     bool Has(const std::string &key) const {
-        return Data.count(key);
+        return Data.count(key) || Typed.count(key);
     }
 
     std::string Get(const std::string &key) const {
@@ -28,15 +41,24 @@ public:
     }
 
     void Set(const std::string &key, const std::string &val) {
+        Typed.erase(key);
         Data[key] = val;
     }
 
+    void SetTyped(const std::string &key, const std::string &val) {
+        Data.erase(key);
+        Typed[key] = val;
+    }
+
     void Del(const std::string &key) {
         Data.erase(key);
+        Typed.erase(key);
     }
 
     TError Load();
     TError Save();
+    TError Update(TKeyValue &saved);
+    TError Remove();
 
     static TError Mount(const TPath &root);
     static TError ListAll(const TPath &root, std::list<TKeyValue> &nodes);
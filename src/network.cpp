@@ -639,6 +639,7 @@ TError TNetwork::SetupQueue(TNetDevice &dev) {
 }
 
 TError TNetwork::SyncDevices(bool force) {
+    TTraceScope trace(TraceNetlink);
     struct nl_cache *cache;
     TError error;
     int ret;
@@ -1093,6 +1094,7 @@ TError TNetwork::SetupClass(TNetDevice &dev, TNetClass &cfg) {
 }
 
 TError TNetwork::DeleteClass(TNetDevice &dev, TNetClass &cfg) {
+    TTraceScope trace(TraceNetlink);
     TError error;
 
     TNlQdisc ctq(dev.Index, cfg.Handle, TC_HANDLE(TC_H_MIN(cfg.Handle), CONTAINER_TC_MINOR));
@@ -1136,6 +1138,7 @@ TError TNetwork::TrySetupClasses(TNetClass &cls) {
 }
 
 TError TNetwork::SetupClasses(TNetClass &cls) {
+    TTraceScope trace(TraceNetlink);
     TError error;
 
     error = TrySetupClasses(cls);
@@ -1213,6 +1216,7 @@ void TNetwork::FatalError(TError &error) {
 }
 
 TError TNetwork::RepairLocked() {
+    TTraceScope trace(TraceNetlink);
     bool force = NetError.GetError() != EError::Queued;
     TError error;
 
@@ -1322,6 +1326,7 @@ void TNetwork::InitStat(TNetClass &cls) {
 }
 
 void TNetwork::SyncStatLocked() {
+    TTraceScope trace(TraceNetlink);
     bool hostNet = this == HostNetwork.get();
     TError error;
 
@@ -1499,6 +1504,7 @@ TError TNetwork::StartNetwork(TContainer &ct, TTaskEnv &task) {
 }
 
 void TNetwork::StopNetwork(TContainer &ct) {
+    TTraceScope trace(TraceNetlink);
     TError error;
 
     auto state_lock = ct.LockNetState();
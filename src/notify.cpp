@@ -0,0 +1,222 @@
+#include <algorithm>
+
+#include "notify.hpp"
+#include "client.hpp"
+#include "config.hpp"
+#include "event.hpp"
+#include "portod.hpp"
+#include "util/string.hpp"
+#include "util/unix.hpp"
+#include "util/log.hpp"
+
+#include "rpc.pb.h"
+
+TNotifyLog NotifyLog;
+
+bool TSubscription::Match(TClient &client, const TNotifyEvent &event,
+                          std::string &name) const {
+    if (!Types.empty() && std::find(Types.begin(), Types.end(), event.Type) == Types.end())
+        return false;
+
+    switch (event.Object) {
+    case ENotifyObject::Container:
+        if (client.ComposeName(event.Name, name))
+            return false;
+        if (Names.empty())
+            return true;
+        for (auto &mask: Names)
+            if (StringMatch(name, mask))
+                return true;
+        return false;
+    case ENotifyObject::Volume:
+        name = client.ComposePath(event.Name).ToString();
+        return !name.empty();
+    case ENotifyObject::Layer:
+        name = event.Name;
+        return !client.CanControlPlace(event.Place);
+    }
+
+    return false;
+}
+
+static void FillEvent(rpc::TPortoEvent *msg, const TNotifyEvent &event,
+                      const std::string &name) {
+    msg->set_seq(event.Seq);
+    msg->set_time(event.TimeMs);
+    msg->set_type(event.Type);
+    msg->set_name(name);
+    if (!event.Value.empty())
+        msg->set_value(event.Value);
+    if (!event.Place.empty())
+        msg->set_place(event.Place);
+}
+
+TError TNotifyLog::Push(TClient &client, TSubscription &sub,
+                        rpc::TContainerResponse &rsp) {
+    if (sub.Lost)
+        rsp.mutable_subscribe()->set_lost(sub.Lost);
+    if (sub.Tagged)
+        rsp.set_reqid(sub.RequestId);
+
+    TError error = client.QueueResponse(rsp, false);
+    if (!error)
+        sub.Lost = 0;
+    else if (error.GetError() == EError::Busy)
+        sub.Lost += rsp.subscribe().event_size();
+
+    return error;
+}
+
+void TNotifyLog::Publish(ENotifyObject object, const std::string &type,
+                         const std::string &name, const std::string &value,
+                         const std::string &place) {
+    auto lock = ScopedLock();
+
+    Ring.push_back({++LastSeq, GetWallTimeMs(), object, type, name, place, value});
+    while (Ring.size() > config().daemon().event_log_size())
+        Ring.pop_front();
+
+    if (Subscriptions.empty() || DeliveryQueued || !EventQueue)
+        return;
+
+    DeliveryQueued = true;
+    lock.unlock();
+
+    EventQueue->Add(0, TEvent(EEventType::NotifyEvents));
+}
+
+void TNotifyLog::Deliver() {
+    std::vector<std::shared_ptr<TSubscription>> subs;
+    std::vector<TNotifyEvent> events;
+    uint64_t lastSeq;
+
+    std::unique_lock<std::mutex> delivery(DeliveryMutex);
+    auto lock = ScopedLock();
+
+    DeliveryQueued = false;
+    lastSeq = LastSeq;
+
+    uint64_t since = lastSeq;
+    for (auto it = Subscriptions.begin(); it != Subscriptions.end(); ) {
+        if ((*it)->Client.expired()) {
+            it = Subscriptions.erase(it);
+            continue;
+        }
+        since = std::min(since, (*it)->Seq);
+        subs.push_back(*it);
+        ++it;
+    }
+
+    for (auto &event: Ring)
+        if (event.Seq > since)
+            events.push_back(event);
+
+    lock.unlock();
+
+    for (auto &sub: subs) {
+        auto client = sub->Client.lock();
+        if (!client)
+            continue;
+
+        rpc::TContainerResponse rsp;
+        rsp.set_error(EError::Success);
+        auto msg = rsp.mutable_subscribe();
+
+        /* events rotated out of ring before delivery */
+        uint64_t next = events.empty() ? lastSeq + 1 : events.front().Seq;
+        if (next > sub->Seq + 1)
+            sub->Lost += next - sub->Seq - 1;
+
+        client->IdentityMutex.lock();
+        for (auto &event: events) {
+            std::string name;
+            if (event.Seq > sub->Seq && sub->Match(*client, event, name))
+                FillEvent(msg->add_event(), event, name);
+        }
+        client->IdentityMutex.unlock();
+
+        sub->Seq = lastSeq;
+
+        if (!msg->event_size())
+            continue;
+
+        TError error = Push(*client, *sub, rsp);
+        if (error && error.GetError() != EError::Busy)
+            L_WRN("Cannot push event to {}: {}", client->Id, error);
+    }
+}
+
+TError TNotifyLog::Subscribe(std::shared_ptr<TClient> &client,
+                             const rpc::TSubscribeRequest &req,
+                             const rpc::TContainerRequest &request) {
+    auto sub = std::make_shared<TSubscription>();
+    rpc::TContainerResponse rsp;
+
+    sub->Client = client;
+    sub->Names.assign(req.name().begin(), req.name().end());
+    sub->Types.assign(req.type().begin(), req.type().end());
+    sub->Tagged = request.has_reqid();
+    sub->RequestId = request.reqid();
+
+    rsp.set_error(EError::Success);
+    auto msg = rsp.mutable_subscribe();
+
+    auto lock = ScopedLock();
+
+    msg->set_seq(LastSeq);
+    sub->Seq = LastSeq;
+
+    if (req.has_since()) {
+        if (req.since() < LastSeq && (Ring.empty() || Ring.front().Seq > req.since() + 1))
+            msg->set_truncated(true);
+
+        client->IdentityMutex.lock();
+        for (auto &event: Ring) {
+            std::string name;
+            if (event.Seq > req.since() && sub->Match(*client, event, name))
+                FillEvent(msg->add_event(), event, name);
+        }
+        client->IdentityMutex.unlock();
+    }
+
+    TError error = Push(*client, *sub, rsp);
+    if (!error)
+        Subscriptions.push_back(sub);
+
+    return error;
+}
+
+TError TNotifyLog::Unsubscribe(TClient &client) {
+    bool found = false;
+
+    /* pending delivery must not push events after final response */
+    std::unique_lock<std::mutex> delivery(DeliveryMutex);
+    auto lock = ScopedLock();
+
+    for (auto it = Subscriptions.begin(); it != Subscriptions.end(); ) {
+        auto sub = *it;
+        if (sub->Client.lock().get() != &client) {
+            ++it;
+            continue;
+        }
+
+        it = Subscriptions.erase(it);
+        found = true;
+
+        /* final response completes subscribe request */
+        rpc::TContainerResponse rsp;
+        rsp.set_error(EError::Success);
+        rsp.mutable_subscribe();
+        if (sub->Tagged)
+            rsp.set_reqid(sub->RequestId);
+
+        TError error = client.QueueResponse(rsp);
+        if (error)
+            L_WRN("Cannot send response for {} : {}", client.Id, error);
+    }
+
+    if (!found)
+        return TError(EError::InvalidState, "Not subscribed");
+
+    return TError::Success();
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+
+#include "common.hpp"
+#include "util/locks.hpp"
+
+class TClient;
+
+namespace rpc {
+    class TSubscribeRequest;
+    class TContainerRequest;
+    class TContainerResponse;
+}
+
+enum class ENotifyObject {
+    Container,
+    Volume,
+    Layer,
+};
+
+struct TNotifyEvent {
+    uint64_t Seq;
+    uint64_t TimeMs;
+    ENotifyObject Object;
+    std::string Type;
+    std::string Name;   /* absolute container name, volume path or layer */
+    std::string Place;  /* for layers */
+    std::string Value;  /* state, exit status */
+};
+
+struct TSubscription {
+    std::weak_ptr<TClient> Client;
+    std::vector<std::string> Names; /* container masks, empty for any */
+    std::vector<std::string> Types; /* empty for any */
+    bool Tagged = false;
+    uint64_t RequestId = 0;
+    uint64_t Lost = 0;
+    uint64_t Seq = 0;   /* last delivered event */
+
+    bool Match(TClient &client, const TNotifyEvent &event, std::string &name) const;
+};
+
+/*
+ * Numbered events are kept in bounded ring for replay. Publish only
+ * appends into ring, it is called under containers lock. Delivery runs
+ * in event worker and pushes new events into matching subscriptions.
+ * Each push is a response for subscribe request, which stays in flight
+ * until unsubscribe. Events are dropped for client with full output or
+ * when ring rotates before delivery, they are counted in "lost".
+ */
+class TNotifyLog : public TLockable, public TNonCopyable {
+    uint64_t LastSeq = 0;
+    std::deque<TNotifyEvent> Ring;
+    std::list<std::shared_ptr<TSubscription>> Subscriptions;
+
+    bool DeliveryQueued = false;
+    std::mutex DeliveryMutex; /* serializes delivery and unsubscribe */
+
+    TError Push(TClient &client, TSubscription &sub, rpc::TContainerResponse &rsp);
+
+public:
+    void Publish(ENotifyObject object, const std::string &type,
+                 const std::string &name, const std::string &value = "",
+                 const std::string &place = "");
+    void Deliver();
+
+    TError Subscribe(std::shared_ptr<TClient> &client,
+                     const rpc::TSubscribeRequest &req,
+                     const rpc::TContainerRequest &request);
+    TError Unsubscribe(TClient &client);
+};
+
+extern TNotifyLog NotifyLog;
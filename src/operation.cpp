@@ -0,0 +1,307 @@
+#include <map>
+#include <algorithm>
+#include <csignal>
+
+#include "operation.hpp"
+#include "client.hpp"
+#include "config.hpp"
+#include "event.hpp"
+#include "rpc.hpp"
+#include "portod.hpp"
+#include "util/log.hpp"
+#include "util/string.hpp"
+#include "util/unix.hpp"
+#include "util/worker.hpp"
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+}
+
+__thread TOperation *TOperation::Current = nullptr;
+
+static std::mutex OperationsMutex;
+static std::map<uint64_t, std::shared_ptr<TOperation>> Operations;
+static uint64_t LastOperationId = 0;
+
+class TOperationWorker : public TWorker<std::shared_ptr<TOperation>> {
+public:
+    TOperationWorker(size_t nr) : TWorker("portod-op", nr) {}
+
+    const std::shared_ptr<TOperation> &Top() override {
+        return Queue.front();
+    }
+
+    bool Handle(const std::shared_ptr<TOperation> &op) override {
+        op->Execute();
+        return true;
+    }
+};
+
+static std::unique_ptr<TOperationWorker> Executor;
+
+void TOperation::StartExecutor() {
+    Executor = std::unique_ptr<TOperationWorker>(
+            new TOperationWorker(config().daemon().operation_threads()));
+    Executor->Start();
+}
+
+/*
+ * Queued operations are cancelled at once, running ones get time to finish:
+ * cancelled helper would leave half-imported layer or half-built volume.
+ */
+void TOperation::StopExecutor() {
+    uint64_t deadline = GetCurrentTimeMs() + config().daemon().operation_drain_ms();
+    bool running;
+
+    do {
+        running = false;
+        std::unique_lock<std::mutex> lock(OperationsMutex);
+        for (auto &it: Operations) {
+            auto &op = it.second;
+            if (op->State == EOperationState::Queued ||
+                    GetCurrentTimeMs() >= deadline)
+                op->Cancel();
+            else if (op->State == EOperationState::Running)
+                running = true;
+        }
+        lock.unlock();
+        if (running)
+            usleep(100000);
+    } while (running);
+
+    if (Executor)
+        Executor->Stop();
+}
+
+/* client could be re-identified meanwhile, operation keeps identity of request */
+TOperation::TOperation(std::shared_ptr<TClient> client,
+                       const rpc::TContainerRequest &request) :
+    Owner(client->Cred), ClientPid(client->Pid), Client(client->DetachIdentity()), Request(request),
+    State(EOperationState::Queued), Cancelled(false) {}
+
+TError TOperation::Queue(std::shared_ptr<TOperation> &op) {
+    uint64_t now = GetCurrentTimeMs();
+
+    if (!Executor)
+        return TError(EError::NotSupported, "I/O executor is not running");
+
+    std::unique_lock<std::mutex> lock(OperationsMutex);
+
+    uint64_t active = 0, client = 0;
+
+    /* results are kept for a while for late pollers */
+    for (auto it = Operations.begin(); it != Operations.end(); ) {
+        auto &old = it->second;
+        if (old->State == EOperationState::Done) {
+            if (now > old->FinishTimeMs + config().daemon().operation_ttl_ms()) {
+                it = Operations.erase(it);
+                continue;
+            }
+        } else {
+            active++;
+            /* one client could open many connections, count per process */
+            if (old->ClientPid == op->ClientPid)
+                client++;
+        }
+        ++it;
+    }
+
+    if (active >= config().daemon().max_operations())
+        return TError(EError::ResourceNotAvailable, "Too many operations: " +
+                      std::to_string(active));
+
+    if (client >= config().daemon().max_client_operations())
+        return TError(EError::ResourceNotAvailable, "Too many operations of client: " +
+                      std::to_string(client));
+
+    op->Id = ++LastOperationId;
+    Operations[op->Id] = op;
+    lock.unlock();
+
+    Executor->Push(op);
+
+    return TError::Success();
+}
+
+std::shared_ptr<TOperation> TOperation::Find(uint64_t id) {
+    std::unique_lock<std::mutex> lock(OperationsMutex);
+    auto it = Operations.find(id);
+    if (it == Operations.end())
+        return nullptr;
+    return it->second;
+}
+
+void TOperation::Execute() {
+    auto lock = ScopedLock();
+
+    if (!Cancelled) {
+        TError error = Listing.CreateUnnamed("/tmp", O_APPEND);
+        if (error)
+            L_WRN("Cannot create listing for operation {}: {}", Id, error);
+
+        State = EOperationState::Running;
+        lock.unlock();
+
+        Current = this;
+        ExecuteOperation(*this);
+        Current = nullptr;
+    } else {
+        Result.set_error(EError::InvalidState);
+        Result.set_errormsg("Operation cancelled");
+        lock.unlock();
+    }
+
+    Finish();
+}
+
+void TOperation::Finish() {
+    auto lock = ScopedLock();
+
+    UpdateProgress();
+    Listing.Close();
+    FinishTimeMs = GetCurrentTimeMs();
+    State = EOperationState::Done;
+
+    for (auto &waiter: Waiters) {
+        auto client = waiter.Client.lock();
+        if (!client)
+            continue;
+
+        rpc::TContainerResponse rsp;
+        rsp.set_error(EError::Success);
+        Fill(*rsp.mutable_operation());
+        if (waiter.Tagged)
+            rsp.set_reqid(waiter.RequestId);
+
+        TError error = client->QueueResponse(rsp);
+        if (error)
+            L_WRN("Cannot send response for {} : {}", client->Id, error);
+    }
+    Waiters.clear();
+
+    /* result does not need client anymore */
+    Client = nullptr;
+}
+
+static uint64_t HelperBytes(pid_t pid) {
+    std::vector<std::string> lines;
+    uint64_t bytes = 0;
+
+    if (TPath("/proc/" + std::to_string(pid) + "/io").ReadLines(lines))
+        return 0;
+
+    for (auto &line: lines) {
+        if (StringStartsWith(line, "rchar: ")) {
+            (void)StringToUint64(line.substr(7), bytes);
+            break;
+        }
+    }
+
+    return bytes;
+}
+
+void TOperation::UpdateProgress() {
+    char buf[65536];
+    ssize_t len;
+
+    if (Listing.Fd < 0)
+        return;
+
+    /* count only new part of listing */
+    while ((len = pread(Listing.Fd, buf, sizeof(buf), ListingOffset)) > 0) {
+        Files += std::count(buf, buf + len, '\n');
+        ListingOffset += len;
+    }
+}
+
+void TOperation::StartHelper(pid_t pid) {
+    auto lock = ScopedLock();
+    Helper = pid;
+    if (Cancelled)
+        kill(pid, SIGKILL);
+}
+
+void TOperation::FinishHelper(pid_t pid) {
+    uint64_t bytes = HelperBytes(pid);
+    auto lock = ScopedLock();
+    Bytes += bytes;
+    Helper = 0;
+}
+
+void TOperation::Cancel() {
+    auto lock = ScopedLock();
+    Cancelled = true;
+    if (Helper)
+        kill(Helper, SIGKILL);
+}
+
+void TOperation::Fill(rpc::TOperationResponse &rsp) {
+    rsp.set_id(Id);
+
+    switch (State) {
+    case EOperationState::Queued:
+        rsp.set_state("queued");
+        break;
+    case EOperationState::Running:
+        rsp.set_state("running");
+        break;
+    case EOperationState::Done:
+        rsp.set_state(Cancelled ? "cancelled" : "done");
+        rsp.mutable_result()->CopyFrom(Result);
+        break;
+    }
+
+    UpdateProgress();
+    rsp.set_bytes(Bytes + (Helper ? HelperBytes(Helper) : 0));
+    rsp.set_files(Files);
+}
+
+TError TOperation::Wait(std::shared_ptr<TClient> &client,
+                        const rpc::TContainerRequest &request,
+                        uint32_t timeoutMs, rpc::TContainerResponse &rsp) {
+    auto lock = ScopedLock();
+
+    if (State == EOperationState::Done || !timeoutMs) {
+        Fill(*rsp.mutable_operation());
+        return TError::Success();
+    }
+
+    Waiters.push_back({++LastWaiter, client, request.has_reqid(), request.reqid()});
+
+    TEvent e(EEventType::OperationTimeout);
+    e.Operation.Id = Id;
+    e.Operation.Waiter = LastWaiter;
+    EventQueue->Add(timeoutMs, e);
+
+    return TError::Queued();
+}
+
+void TOperation::WaitTimeout(uint64_t id, uint64_t waiter) {
+    auto op = Find(id);
+    if (!op)
+        return;
+
+    auto lock = op->ScopedLock();
+
+    for (auto it = op->Waiters.begin(); it != op->Waiters.end(); ++it) {
+        if (it->Id != waiter)
+            continue;
+
+        auto client = it->Client.lock();
+        if (client) {
+            rpc::TContainerResponse rsp;
+            rsp.set_error(EError::Success);
+            op->Fill(*rsp.mutable_operation());
+            if (it->Tagged)
+                rsp.set_reqid(it->RequestId);
+
+            TError error = client->QueueResponse(rsp);
+            if (error)
+                L_WRN("Cannot send response for {} : {}", client->Id, error);
+        }
+
+        op->Waiters.erase(it);
+        break;
+    }
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <string>
+#include <list>
+#include <memory>
+#include <atomic>
+
+#include "common.hpp"
+#include "util/locks.hpp"
+#include "util/path.hpp"
+#include "util/cred.hpp"
+
+#include "rpc.pb.h"
+
+class TClient;
+
+enum class EOperationState {
+    Queued,
+    Running,
+    Done,
+};
+
+struct TOperationWaiter {
+    uint64_t Id;
+    std::weak_ptr<TClient> Client;
+    bool Tagged;
+    uint64_t RequestId;
+};
+
+/*
+ * Heavy request executed in background by size-limited I/O executor.
+ * Client gets operation id at once and polls, waits or cancels it.
+ *
+ * Progress is collected from helper commands started by RunCommand:
+ * bytes are taken from /proc/<pid>/io, files are counted as lines of
+ * listing which helpers write into Listing.
+ */
+class TOperation : public TLockable, public TNonCopyable {
+    std::list<TOperationWaiter> Waiters;
+    uint64_t LastWaiter = 0;
+
+    pid_t Helper = 0;
+    uint64_t Bytes = 0;
+    uint64_t Files = 0;
+    uint64_t ListingOffset = 0;
+
+    void UpdateProgress();
+    void Fill(rpc::TOperationResponse &rsp);
+    void Finish();
+
+public:
+    uint64_t Id = 0;
+    TCred Owner;
+    pid_t ClientPid;
+    std::shared_ptr<TClient> Client;
+    rpc::TContainerRequest Request;
+    rpc::TContainerResponse Result;
+    uint64_t FinishTimeMs = 0;
+
+    std::atomic<EOperationState> State;
+    std::atomic<bool> Cancelled;
+
+    TFile Listing;
+
+    /* operation executed by this thread */
+    static __thread TOperation *Current;
+
+    TOperation(std::shared_ptr<TClient> client, const rpc::TContainerRequest &request);
+
+    void StartHelper(pid_t pid);
+    void FinishHelper(pid_t pid);
+
+    void Cancel();
+    void Execute();
+
+    TError Wait(std::shared_ptr<TClient> &client, const rpc::TContainerRequest &request,
+                uint32_t timeoutMs, rpc::TContainerResponse &rsp);
+
+    static TError Queue(std::shared_ptr<TOperation> &op);
+    static std::shared_ptr<TOperation> Find(uint64_t id);
+    static void WaitTimeout(uint64_t id, uint64_t waiter);
+
+    static void StartExecutor();
+    static void StopExecutor();
+};
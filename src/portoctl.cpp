@@ -12,6 +12,7 @@
 #include "util/signal.hpp"
 #include "util/unix.hpp"
 #include "util/cred.hpp"
+#include "util/log.hpp"
 
 extern "C" {
 #include <unistd.h>
@@ -2452,6 +2453,79 @@ public:
     }
 };
 
+class TTraceCmd final : public ICmd {
+public:
+    TTraceCmd(Porto::Connection *api) : ICmd(api, "trace", 0,
+            "[-s]", "show traces of recent requests",
+            "    -s         show slowest requests\n") { }
+
+    int Execute(TCommandEnviroment *env) final override {
+        bool slowest = false;
+        env->GetOpts({
+                {'s', false, [&](const char *) { slowest = true; }},
+        });
+
+        std::vector<Porto::RequestTrace> traces;
+        int ret = Api->DumpTraces(traces, slowest);
+        if (ret) {
+            PrintError("Cannot get traces");
+            return ret;
+        }
+
+        for (auto &trace: traces) {
+            std::cout << FormatTime(trace.Time / 1000) << " "
+                      << trace.TotalUs << "us " << trace.Client << " "
+                      << trace.Request;
+            if (trace.Error)
+                std::cout << " " << ErrorName(trace.Error);
+            std::cout << std::endl;
+
+            for (auto &stage: trace.Stages)
+                std::cout << "\t" << stage.first << "\t" << stage.second << "us" << std::endl;
+        }
+
+        return EXIT_SUCCESS;
+    }
+};
+
+class TLogCmd final : public ICmd {
+public:
+    TLogCmd(Porto::Connection *api) : ICmd(api, "log", 0,
+            "[file]", "print log with binary records decoded",
+            std::string() + "    default file is " + PORTO_LOG + "\n") { }
+
+    int Execute(TCommandEnviroment *env) final override {
+        const auto &args = env->GetArgs();
+        TPath path = args.size() ? args[0] : PORTO_LOG;
+        std::string data, text;
+        char buf[65536];
+        TFile file;
+        ssize_t len;
+
+        TError error = file.OpenRead(path);
+        if (error) {
+            PrintError(error, "Cannot open log");
+            return EXIT_FAILURE;
+        }
+
+        do {
+            len = read(file.Fd, buf, sizeof(buf));
+            if (len > 0)
+                data.append(buf, len);
+            data.erase(0, DecodeLog(data.c_str(), data.size(), text, len <= 0));
+            std::cout << text << std::flush;
+            text.clear();
+        } while (len > 0);
+
+        if (len < 0) {
+            PrintError(TError(EError::Unknown, errno, "read"), "Cannot read log");
+            return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+    }
+};
+
 class TSaveCmd final : public ICmd {
 public:
     TSaveCmd(Porto::Connection *api) : ICmd(api, "save", 1,
@@ -2733,6 +2807,8 @@ int main(int argc, char *argv[]) {
 
     handler.RegisterCommand<TConvertPathCmd>();
     handler.RegisterCommand<TAttachCmd>();
+    handler.RegisterCommand<TTraceCmd>();
+    handler.RegisterCommand<TLogCmd>();
 
     handler.RegisterCommand<TSaveCmd>();
     handler.RegisterCommand<TLoadCmd>();
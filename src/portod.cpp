@@ -1,6 +1,8 @@
 #include <vector>
+#include <map>
 #include <string>
 #include <algorithm>
+#include <thread>
 #include <csignal>
 #include <iostream>
 
@@ -19,6 +21,8 @@
 #include "storage.hpp"
 #include "helpers.hpp"
 #include "protobuf.hpp"
+#include "operation.hpp"
+#include "trace.hpp"
 #include "util/log.hpp"
 #include "util/signal.hpp"
 #include "util/unix.hpp"
@@ -34,6 +38,7 @@ extern "C" {
 #include <unistd.h>
 #include <sys/un.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <poll.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -73,6 +78,7 @@ static void AllocStatistics() {
 
 static void DaemonShutdown(bool master, int code) {
     L_SYS("Stopped {}", code);
+    StopLogWriter();
 
     if (master)
         MasterPidFile.Remove();
@@ -93,18 +99,60 @@ static void DaemonShutdown(bool master, int code) {
 struct TRequest {
     std::shared_ptr<TClient> Client;
     rpc::TContainerRequest Request;
+    uint64_t RecvUs;
+    uint64_t QueuedUs;
 };
 
-class TRpcWorker : public TWorker<TRequest> {
+class TRpcWorker : public TMpmcWorker<TRequest> {
 public:
-    TRpcWorker(const size_t nr) : TWorker("portod-worker", nr) {}
+    /* when queue is full client loop stops reading from client, see ClientLoopFn */
+    TRpcWorker(const size_t nr) : TMpmcWorker("portod-worker", nr,
+                                              config().daemon().max_clients() * 2,
+                                              NR_REQUEST_CLASSES) {
+        size_t read = config().daemon().read_workers();
+        size_t heavy = config().daemon().heavy_workers();
+        size_t share = config().daemon().client_workers();
 
-    const TRequest &Top() override {
-        return Queue.front();
+        /* reads could take all workers, others leave reserve for reads */
+        SetClassLimit(RequestRead, nr, share);
+        SetClassLimit(RequestWrite, nr > read ? nr - read : 1, share);
+        SetClassLimit(RequestHeavy, heavy, share);
+    }
+
+    int Classify(const TRequest &request) override {
+        return RequestClass(request.Request);
+    }
+
+    /* one client could open many connections, share workers per process */
+    size_t FairKey(const TRequest &request) override {
+        return request.Client->Pid;
     }
 
     bool Handle(const TRequest &request) override {
+        auto type = RequestType(request.Request);
+        uint64_t start = GetCurrentTimeUs();
+        TRequestTrace trace;
+
+        if (config().daemon().request_trace() && !request.Request.has_trace()) {
+            trace.TimeMs = GetWallTimeMs();
+            trace.StageUs[TraceRecv] = request.RecvUs;
+            trace.StageCount[TraceRecv] = 1;
+            trace.StageUs[TraceQueue] = start - request.QueuedUs;
+            trace.StageCount[TraceQueue] = 1;
+            TRequestTrace::Current = &trace;
+        }
+
+        Statistics->RequestsWait[type].Add(start - request.QueuedUs);
         HandleRpcRequest(request.Request, request.Client);
+        request.Client->FinishExecution();
+        Statistics->RequestsExec[type].Add(GetCurrentTimeUs() - start);
+
+        if (TRequestTrace::Current) {
+            TRequestTrace::Current = nullptr;
+            trace.TotalUs = GetCurrentTimeUs() - request.QueuedUs + request.RecvUs;
+            TraceLog.Add(trace);
+        }
+
         Statistics->RequestsCompleted++;
         Statistics->RequestsQueued--;
 
@@ -367,20 +415,52 @@ retry:
 }
 
 static std::map<int, std::shared_ptr<TClient>> Clients;
+static std::mutex ClientsMutex;
+
+static inline std::unique_lock<std::mutex> LockClients() {
+    return std::unique_lock<std::mutex>(ClientsMutex);
+}
+
+/*
+ * Client connections are spread across several epoll loops,
+ * each served by own thread. Control fds (signals, reaper events,
+ * listening socket and oom eventfds) stay in the main EpollLoop.
+ */
+static std::vector<std::unique_ptr<TEpollLoop>> ClientLoops;
+static std::vector<std::thread> ClientThreads;
+static size_t ClientLoopSeq = 0; /* under ClientsMutex */
+static TFile ClientLoopsStop;
+static std::shared_ptr<TEpollSource> ClientLoopsStopSource; /* loops keep weak refs */
+
+static void DropClient(std::shared_ptr<TClient> client) {
+    auto lock = LockClients();
+    auto it = Clients.find(client->Fd);
+    if (it != Clients.end() && it->second == client)
+        Clients.erase(it);
+    lock.unlock();
+    client->CloseConnection();
+}
 
 static TError DropIdleClient(std::shared_ptr<TContainer> from = nullptr) {
     uint64_t idle = config().daemon().client_idle_timeout() * 1000;
     uint64_t now = GetCurrentTimeMs();
     std::shared_ptr<TClient> victim;
 
+    auto lock = LockClients();
+
     for (auto &it: Clients) {
         auto &client = it.second;
 
-        if (client->Processing)
+        if (client->Processing || client->Dropping)
             continue;
 
-        if (from && client->ClientContainer != from)
-            continue;
+        if (from) {
+            client->IdentityMutex.lock();
+            bool other = client->ClientContainer != from;
+            client->IdentityMutex.unlock();
+            if (other)
+                continue;
+        }
 
         if (now - client->ActivityTimeMs > idle) {
             victim = client;
@@ -393,10 +473,10 @@ static TError DropIdleClient(std::shared_ptr<TContainer> from = nullptr) {
                       "All client slots are active: " +
                       (from ? from->Name : "globally"));
 
+    /* loop thread could be reading this client, it closes connection */
     L("Drop client {} idle for {} ms", victim->Id, idle);
-    Clients.erase(victim->Fd);
-    victim->CloseConnection();
-    return TError::Success();
+    lock.unlock();
+    return victim->ScheduleDrop();
 }
 
 static TError AcceptConnection(int listenFd) {
@@ -432,16 +512,142 @@ static TError AcceptConnection(int listenFd) {
             return error;
     }
 
-    error = EpollLoop->AddSource(client);
+    auto lock = LockClients();
+
+    /* round-robin, connections are cheap and mostly alike */
+    auto loop = ClientLoops[ClientLoopSeq++ % ClientLoops.size()].get();
+
+    error = loop->AddSource(client);
     if (error)
         return error;
 
-    client->InEpoll = true; /* FIXME cleanup this crap */
+    client->Loop = loop;
     Clients[client->Fd] = client;
 
     return TError::Success();
 }
 
+static void ClientLoopFn(TEpollLoop *loop, TRpcWorker *worker, const std::string &name) {
+    std::vector<struct epoll_event> events;
+    std::list<TRequest> stalled; /* held back while worker queue is full */
+
+    SetProcessName(name);
+
+    while (true) {
+        /* stalled clients have no input events, recheck queue periodically */
+        TError error = loop->GetEvents(events, stalled.empty() ? -1 : 1);
+        if (error) {
+            L_ERR("{}: epoll error {}", name, error);
+            Crash();
+        }
+
+        while (!stalled.empty() && worker->Push(stalled.front())) {
+            auto client = stalled.front().Client;
+            stalled.pop_front();
+            error = client->StallInput(false);
+            if (error)
+                DropClient(client);
+        }
+
+        for (auto ev : events) {
+            if (ev.data.fd == ClientLoopsStop.Fd)
+                return;
+
+            auto source = loop->GetSource(ev.data.fd);
+            if (!source)
+                continue;
+
+            error = TError::Success();
+
+            /* client loops contain only clients */
+            auto client = std::static_pointer_cast<TClient>(source);
+
+            if (client->Dropping) {
+                DropClient(client);
+                continue;
+            }
+
+            if (ev.events & EPOLLOUT)
+                error = client->SendResponse(false);
+
+            /* take all buffered pipelined requests, output kicks them too */
+            while (!error && (ev.events & (EPOLLIN | EPOLLOUT))) {
+                TRequest req;
+
+                req.Client = client;
+                req.RecvUs = GetCurrentTimeUs();
+                error = client->ReadRequest(req.Request);
+                if (error)
+                    break;
+
+                /* identity is shared by executing requests, recheck it between them */
+                if (client->Executing == 1)
+                    error = client->IdentifyClient(false);
+
+                if (!error) {
+                    client->ClientContainer->ContainerRequests++;
+                    Statistics->RequestsQueued++;
+                    req.QueuedUs = GetCurrentTimeUs();
+                    req.RecvUs = req.QueuedUs - req.RecvUs;
+                    if (!worker->Push(req)) {
+                        stalled.push_back(req);
+                        error = client->StallInput(true);
+                        if (!error)
+                            break;
+                    }
+                }
+            }
+
+            if ((ev.events & EPOLLHUP) || (ev.events & EPOLLERR) ||
+                    (error && error.GetError() != EError::Queued))
+                DropClient(client);
+        }
+    }
+}
+
+static TError StartClientLoops(TRpcWorker &worker) {
+    size_t nr = std::max(config().daemon().io_threads(), 1u);
+    TError error;
+
+    ClientLoopsStop.SetFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (ClientLoopsStop.Fd < 0)
+        return TError(EError::Unknown, errno, "eventfd()");
+
+    ClientLoopsStopSource = std::make_shared<TEpollSource>(ClientLoopsStop.Fd);
+
+    for (size_t i = 0; i < nr; i++) {
+        std::unique_ptr<TEpollLoop> loop(new TEpollLoop());
+
+        error = loop->Create();
+        if (error)
+            return error;
+
+        error = loop->AddSource(ClientLoopsStopSource);
+        if (error)
+            return error;
+
+        ClientLoops.push_back(std::move(loop));
+    }
+
+    for (size_t i = 0; i < nr; i++)
+        ClientThreads.emplace_back(ClientLoopFn, ClientLoops[i].get(), &worker,
+                                   "portod-io" + std::to_string(i));
+
+    return TError::Success();
+}
+
+static void StopClientLoops() {
+    uint64_t val = 1;
+
+    if (ClientLoopsStop.Fd >= 0 &&
+            write(ClientLoopsStop.Fd, &val, sizeof(val)) != sizeof(val))
+        L_ERR("Cannot stop client loops: {}", strerror(errno));
+
+    for (auto &thread: ClientThreads)
+        thread.join();
+    ClientThreads.clear();
+}
+
 static int Rpc() {
     TRpcWorker worker(config().daemon().workers());
     int ret = 0;
@@ -475,6 +681,15 @@ static int Rpc() {
 
     worker.Start();
     EventQueue->Start();
+    TContainer::StartStatCollector();
+    TOperation::StartExecutor();
+
+    error = StartClientLoops(worker);
+    if (error) {
+        L_ERR("Can't start client loops: {}", error);
+        ret = EXIT_FAILURE;
+        goto exit;
+    }
 
     if (config().daemon().log_rotate_ms()) {
         TEvent ev(EEventType::RotateLogs);
@@ -543,9 +758,8 @@ static int Rpc() {
                 if (error)
                     L("Cannot accept connection: {}", error);
             } else if (source->Fd == REAP_EVT_FD) {
-                // we handled all events from the master before events
-                // from the clients (so clients see updated view of the
-                // world as soon as possible)
+                // we handled all events from the master before
+                // other events in this loop
                 continue;
             } else if (source->Flags & EPOLL_EVENT_OOM) {
                 auto container = source->Container.lock();
@@ -558,34 +772,6 @@ static int Rpc() {
                     TEvent e(EEventType::OOM, container);
                     EventQueue->Add(0, e);
                 }
-
-            } else if (Clients.find(source->Fd) != Clients.end()) {
-                auto client = Clients[source->Fd];
-
-                if (ev.events & EPOLLIN) {
-                    TRequest req;
-
-                    req.Client = client;
-                    error = client->ReadRequest(req.Request);
-
-                    if (!error) {
-                        error = client->IdentifyClient(false);
-                        if (!error) {
-                            client->ClientContainer->ContainerRequests++;
-                            Statistics->RequestsQueued++;
-                            worker.Push(req);
-                        }
-                    }
-                }
-
-                if (ev.events & EPOLLOUT)
-                    error = client->SendResponse(false);
-
-                if ((ev.events & EPOLLHUP) || (ev.events & EPOLLERR) ||
-                        (error && error.GetError() != EError::Queued)) {
-                    Clients.erase(source->Fd);
-                    client->CloseConnection();
-                }
             } else {
                 L_WRN("Unknown event {}", source->Fd);
                 EpollLoop->RemoveSource(source->Fd);
@@ -594,12 +780,21 @@ static int Rpc() {
     }
 
 exit:
+    StopClientLoops();
+    TOperation::StopExecutor();
+    TContainer::StopStatCollector();
     EventQueue->Stop();
     worker.Stop();
 
+    auto lock = LockClients();
     for (auto c : Clients)
         c.second->CloseConnection();
     Clients.clear();
+    lock.unlock();
+
+    ClientLoops.clear();
+    ClientLoopsStopSource = nullptr;
+    ClientLoopsStop.Close();
 
     return ret;
 }
@@ -610,10 +805,12 @@ static TError TuneLimits() {
     /*
      * two FDs for each container: OOM event and netlink
      * one for each client
+     * cached cgroup knobs
      * plus some extra
      */
     int maxFd = config().container().max_total() * 2 +
-                config().daemon().max_clients() + 1000;
+                config().daemon().max_clients() +
+                config().daemon().cgroup_knob_fds() + 1000;
 
     rlim.rlim_max = maxFd;
     rlim.rlim_cur = maxFd;
@@ -677,8 +874,103 @@ static TError CreateRootContainer() {
     return TError::Success();
 }
 
-static void RestoreContainers() {
-    std::list<TKeyValue> nodes;
+struct TRestoreTask {
+    TKeyValue *Node;
+    std::shared_ptr<TContainer> Container; /* loaded by lazy restore */
+    std::vector<TRestoreTask *> Childs;
+    bool Drop;
+};
+
+class TRestoreWorker : public TWorker<TRestoreTask *> {
+    std::condition_variable Done;
+    size_t Pending = 0;
+
+public:
+    std::list<TKeyValue> Nodes;
+    std::vector<TRestoreTask> Tasks;
+    uint64_t StartMs = 0;
+
+    TRestoreWorker(size_t nr) : TWorker("portod-restore", nr) {}
+
+    TRestoreTask * const &Top() override {
+        return Queue.front();
+    }
+
+    void Add(TRestoreTask *task) {
+        auto lock = ScopedLock();
+        Pending++;
+        Queue.push(task);
+        Seq++;
+        Cv.notify_one();
+    }
+
+    bool Handle(TRestoreTask * const &task) override {
+        auto &node = *task->Node;
+        std::shared_ptr<TContainer> ct;
+        TError error;
+
+        CL = &SystemClient;
+        if (task->Container)
+            error = TContainer::FinishRestore(task->Container, task->Drop);
+        else
+            error = TContainer::Restore(node, ct);
+        CL = nullptr;
+
+        if (error) {
+            L_ERR("Cannot restore {}: {}", node.Name, error);
+            Statistics->RestoreFailed++;
+            node.Remove();
+        }
+
+        /* lazy restore keeps worker till shutdown, release what is done */
+        node.Data.clear();
+        node.Typed.clear();
+        task->Container = nullptr;
+
+        /* failed parent fails childs too, as in serial restore */
+        for (auto child : task->Childs) {
+            child->Drop = bool(error);
+            Add(child);
+        }
+
+        auto lock = ScopedLock();
+        if (!--Pending) {
+            L_SYS("Restored {} containers in {} ms", Tasks.size(),
+                  GetCurrentTimeMs() - StartMs);
+            Done.notify_all();
+        }
+        return true;
+    }
+
+    void WaitAll() {
+        auto lock = ScopedLock();
+        while (Pending)
+            Done.wait(lock);
+    }
+};
+
+static std::unique_ptr<TRestoreWorker> RestoreWorker;
+
+static void WaitRestore() {
+    if (RestoreWorker) {
+        RestoreWorker->WaitAll();
+        RestoreWorker->Stop();
+        RestoreWorker = nullptr;
+    }
+}
+
+/*
+ * Lazy restore loads metadata of all containers here and leaves
+ * syncing to restore workers, requests wait only for containers
+ * they lock. Otherwise returns when all containers are restored.
+ */
+static void RestoreContainers(bool lazy) {
+    RestoreWorker = std::unique_ptr<TRestoreWorker>(
+            new TRestoreWorker(std::max(config().daemon().restore_threads(), 1u)));
+    auto &nodes = RestoreWorker->Nodes;
+    auto &tasks = RestoreWorker->Tasks;
+
+    RestoreWorker->StartMs = GetCurrentTimeMs();
 
     TError error = TKeyValue::ListAll(ContainersKV, nodes);
     if (error)
@@ -694,7 +986,7 @@ static void RestoreContainers() {
         }
         if (error) {
             L_ERR("Cannot load {}: {}", node->Path, error);
-            (void)node->Path.Unlink();
+            (void)node->Remove();
             node = nodes.erase(node);
             continue;
         }
@@ -705,19 +997,49 @@ static void RestoreContainers() {
 
     nodes.sort();
 
+    /* child is queued when its parent is done, siblings go in parallel */
+    std::map<std::string, TRestoreTask *> byName;
+
+    tasks.reserve(nodes.size());
     for (auto &node : nodes) {
         if (node.Name[0] == '/')
             continue;
 
         std::shared_ptr<TContainer> ct;
-        error = TContainer::Restore(node, ct);
-        if (error) {
-            L_ERR("Cannot restore {}: {}", node.Name, error);
-            Statistics->RestoreFailed++;
-            node.Path.Unlink();
-            continue;
+        if (lazy) {
+            error = TContainer::Restore(node, ct, true);
+            if (error) {
+                L_ERR("Cannot restore {}: {}", node.Name, error);
+                Statistics->RestoreFailed++;
+                node.Remove();
+                continue;
+            }
         }
+
+        tasks.push_back({&node, ct, {}, false});
+        byName[node.Name] = &tasks.back();
+    }
+
+    std::vector<TRestoreTask *> roots;
+    for (auto &task : tasks) {
+        auto parent = byName.find(TContainer::ParentName(task.Node->Name));
+        if (parent != byName.end())
+            parent->second->Childs.push_back(&task);
+        else
+            roots.push_back(&task);
     }
+
+    /* workers could outlive start, signals are for signalfd in main thread */
+    sigset_t saved;
+    BlockSignalFd(saved);
+    RestoreWorker->Start();
+    RestoreSignalMask(saved);
+
+    for (auto task : roots)
+        RestoreWorker->Add(task);
+
+    if (!lazy)
+        WaitRestore();
 }
 
 static void CleanupCgroups() {
@@ -752,6 +1074,8 @@ again:
                     (hy->Controllers & CGROUP_FREEZER))
                 continue;
 
+            /* lazy restore could drop containers meanwhile */
+            auto lock = LockContainers();
             bool found = false;
             for (auto &it: Containers) {
                 if (it.second->State != EContainerState::Stopped &&
@@ -760,6 +1084,7 @@ again:
                     break;
                 }
             }
+            lock.unlock();
             if (found)
                 continue;
 
@@ -789,9 +1114,10 @@ static void CleanupTempdir() {
         L_ERR("Cannot list temp dir: {}", error);
 
     for (auto &name: list) {
-        auto it = Containers.find(name);
-        if (it != Containers.end() &&
-                it->second->State != EContainerState::Stopped)
+        auto lock = LockContainers();
+        auto ct = TContainer::Find(name);
+        lock.unlock();
+        if (ct && ct->State != EContainerState::Stopped)
             continue;
         TPath path = temp / name;
         error = RemoveRecursive(path);
@@ -822,6 +1148,16 @@ static void DestroyContainers(bool weak) {
     SystemClient.ReleaseContainer();
 }
 
+/* Lazy restore: event worker waits until weak container is synced */
+static void DestroyWeakContainersLater() {
+    for (auto &ct: RootContainer->Subtree()) {
+        if (ct->IsWeak) {
+            TEvent ev(EEventType::DestroyWeakContainer, ct);
+            EventQueue->Add(0, ev);
+        }
+    }
+}
+
 static int Portod() {
     TError error;
 
@@ -842,6 +1178,10 @@ static int Portod() {
         FatalError("Cannot save pid", error);
 
     config.Load();
+
+    if (config().daemon().log_async())
+        StartLogWriter(config().daemon().log_binary());
+
     InitPortoCgroups();
     InitCapabilities();
     InitIpcSysctl();
@@ -927,13 +1267,18 @@ static int Portod() {
 
     SystemClient.ClientContainer = RootContainer;
 
-    RestoreContainers();
+    bool lazy = config().daemon().lazy_restore() && !discardState;
+
+    RestoreContainers(lazy);
 
     TContainer::SyncPropertiesAll();
 
     TVolume::RestoreAll();
 
-    DestroyContainers(true);
+    if (lazy)
+        DestroyWeakContainersLater();
+    else
+        DestroyContainers(true);
 
     if (discardState) {
         discardState = false;
@@ -955,6 +1300,8 @@ static int Portod() {
     int code = Rpc();
     L_SYS("Shutting down...");
 
+    WaitRestore();
+
     if (discardState) {
         discardState = false;
 
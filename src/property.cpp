@@ -6,10 +6,12 @@
 #include "container.hpp"
 #include "network.hpp"
 #include "statistics.hpp"
+#include "rpc.hpp"
 #include "util/log.hpp"
 #include "util/string.hpp"
 #include "util/unix.hpp"
 #include "util/cred.hpp"
+#include "kv.pb.h"
 #include <sstream>
 
 extern "C" {
@@ -536,6 +538,7 @@ public:
 
         CT->OwnerCred = newCred;
         CT->SetProp(EProperty::OWNER_USER);
+        CT->ClientsGeneration++;
         CT->SanitizeCapabilities();
         return TError::Success();
     }
@@ -565,6 +568,7 @@ public:
 
         CT->OwnerCred.Gid = newGid;
         CT->SetProp(EProperty::OWNER_GROUP);
+        CT->ClientsGeneration++;
         return TError::Success();
     }
 } static OwnerGroup;
@@ -2391,6 +2395,7 @@ public:
 
         CT->AccessLevel = level;
         CT->SetProp(EProperty::ENABLE_PORTO);
+        CT->ClientsGeneration++;
         return TError::Success();
     }
     TError Start(void) {
@@ -3331,6 +3336,55 @@ void TPortoStat::Populate(TUintMap &m) {
     m["requests_longer_3s"] = Statistics->RequestsLonger3s;
     m["requests_longer_30s"] = Statistics->RequestsLonger30s;
     m["requests_longer_5m"] = Statistics->RequestsLonger5m;
+
+    m["lock_waits"] = Statistics->ContainersLockWait.Count();
+    m["lock_wait_p50"] = Statistics->ContainersLockWait.Percentile(50);
+    m["lock_wait_p99"] = Statistics->ContainersLockWait.Percentile(99);
+
+    for (int type = 0; type < NR_REQUEST_TYPES; type++) {
+        auto &wait = Statistics->RequestsWait[type];
+        auto &exec = Statistics->RequestsExec[type];
+        std::string name = RequestTypeName[type];
+        uint64_t count = exec.Count();
+
+        if (!count)
+            continue;
+
+        m["requests_" + name] = count;
+        m["latency_" + name + "_wait_p50"] = wait.Percentile(50);
+        m["latency_" + name + "_wait_p99"] = wait.Percentile(99);
+        m["latency_" + name + "_exec_p50"] = exec.Percentile(50);
+        m["latency_" + name + "_exec_p99"] = exec.Percentile(99);
+    }
+}
+
+/* Whole histogram: "latency_<type>_wait", "latency_<type>_exec" or "lock_wait" */
+static bool GetLatencyHistogram(const std::string &index, std::string &value) {
+    TLatencyHistogram *hist = nullptr;
+
+    if (index == "lock_wait")
+        hist = &Statistics->ContainersLockWait;
+
+    for (int type = 0; !hist && type < NR_REQUEST_TYPES; type++) {
+        std::string name = std::string("latency_") + RequestTypeName[type];
+
+        if (index == name + "_wait")
+            hist = &Statistics->RequestsWait[type];
+        else if (index == name + "_exec")
+            hist = &Statistics->RequestsExec[type];
+    }
+
+    if (!hist)
+        return false;
+
+    value = "";
+    for (int i = 0; i < TLatencyHistogram::BUCKETS; i++) {
+        if (i)
+            value += "; ";
+        value += std::to_string(TLatencyHistogram::BucketLimit(i)) + ": " +
+                 std::to_string(hist->Buckets[i].load());
+    }
+    return true;
 }
 
 TError TPortoStat::Get(std::string &value) {
@@ -3343,6 +3397,10 @@ TError TPortoStat::Get(std::string &value) {
 TError TPortoStat::GetIndexed(const std::string &index,
                                        std::string &value) {
     TUintMap m;
+
+    if (GetLatencyHistogram(index, value))
+        return TError::Success();
+
     Populate(m);
 
     if (m.find(index) == m.end())
@@ -3500,7 +3558,344 @@ public:
 
 } static SysctlProperty;
 
+/*
+ * Typed values are stored in key-value node in native form: restore
+ * simply copies them back without parsing and validation which has
+ * been done when value was set. Legacy text values are still loaded
+ * through SetFromRestore.
+ */
+
+static void EncodeValue(kv::TValue &value, uint64_t val) {
+    value.set_u64(val);
+}
+
+static void DecodeValue(const kv::TValue &value, uint64_t &val) {
+    val = value.u64();
+}
+
+static void EncodeValue(kv::TValue &value, int val) {
+    value.set_i64(val);
+}
+
+static void DecodeValue(const kv::TValue &value, int &val) {
+    val = value.i64();
+}
+
+static void EncodeValue(kv::TValue &value, bool val) {
+    value.set_flag(val);
+}
+
+static void DecodeValue(const kv::TValue &value, bool &val) {
+    val = value.flag();
+}
+
+static void EncodeValue(kv::TValue &value, double val) {
+    value.set_real(val);
+}
+
+static void DecodeValue(const kv::TValue &value, double &val) {
+    val = value.real();
+}
+
+static void EncodeValue(kv::TValue &value, const std::string &val) {
+    value.set_str(val);
+}
+
+static void DecodeValue(const kv::TValue &value, std::string &val) {
+    val = value.str();
+}
+
+static void EncodeValue(kv::TValue &value, const TTuple &val) {
+    for (auto &item: val)
+        value.add_list(item);
+}
+
+static void DecodeValue(const kv::TValue &value, TTuple &val) {
+    val.assign(value.list().begin(), value.list().end());
+}
+
+static void EncodeValue(kv::TValue &value, const TMultiTuple &val) {
+    for (auto &tuple: val) {
+        auto list = value.add_tuples();
+        for (auto &item: tuple)
+            list->add_item(item);
+    }
+}
+
+static void DecodeValue(const kv::TValue &value, TMultiTuple &val) {
+    val.clear();
+    val.reserve(value.tuples_size());
+    for (auto &list: value.tuples())
+        val.emplace_back(list.item().begin(), list.item().end());
+}
+
+static void EncodeValue(kv::TValue &value, const TUintMap &val) {
+    for (auto &it: val) {
+        auto pair = value.add_umap();
+        pair->set_key(it.first);
+        pair->set_val(it.second);
+    }
+}
+
+static void DecodeValue(const kv::TValue &value, TUintMap &val) {
+    val.clear();
+    for (auto &pair: value.umap())
+        val.emplace_hint(val.end(), pair.key(), pair.val());
+}
+
+static void EncodeValue(kv::TValue &value, const TStringMap &val) {
+    for (auto &it: val) {
+        auto pair = value.add_smap();
+        pair->set_key(it.first);
+        pair->set_val(it.second);
+    }
+}
+
+static void DecodeValue(const kv::TValue &value, TStringMap &val) {
+    val.clear();
+    for (auto &pair: value.smap())
+        val.emplace_hint(val.end(), pair.key(), pair.val());
+}
+
+static void EncodeValue(kv::TValue &value, const TCapabilities &val) {
+    value.set_u64(val.Permitted);
+}
+
+static void DecodeValue(const kv::TValue &value, TCapabilities &val) {
+    val.Permitted = value.u64();
+}
+
+/* Specialized for each property which has typed form */
+template <EProperty P> struct TTypedValue;
+
+template <typename T, T TContainer:: *Field, uint64_t Controllers = 0>
+struct TTypedField {
+    static void Save(kv::TValue &value) {
+        EncodeValue(value, CT->*Field);
+    }
+    static TError Load(const TProperty &prop, const kv::TValue &value) {
+        DecodeValue(value, CT->*Field);
+        return prop.WantControllers(Controllers);
+    }
+};
+
+template <TUintMap TContainer:: *Field>
+struct TTypedIoLimit {
+    static void Save(kv::TValue &value) {
+        EncodeValue(value, CT->*Field);
+    }
+    static TError Load(const TProperty &prop, const kv::TValue &value) {
+        auto &map = CT->*Field;
+        uint64_t controllers = 0;
+
+        DecodeValue(value, map);
+        if (map.count("fs"))
+            controllers |= CGROUP_MEMORY;
+        if (map.size() > map.count("fs"))
+            controllers |= CGROUP_BLKIO;
+        return prop.WantControllers(controllers);
+    }
+};
+
+template <TUintMap TNetClass:: *Member>
+struct TTypedNetClass {
+    static void Save(kv::TValue &value) {
+        EncodeValue(value, CT->NetClass.*Member);
+    }
+    static TError Load(const TProperty &prop, const kv::TValue &value) {
+        auto lock = CT->LockNetState();
+        DecodeValue(value, CT->NetClass.*Member);
+        return prop.WantControllers(CGROUP_NETCLS);
+    }
+};
+
+template <> struct TTypedValue<EProperty::COMMAND> :
+    TTypedField<std::string, &TContainer::Command> {};
+template <> struct TTypedValue<EProperty::CORE_COMMAND> :
+    TTypedField<std::string, &TContainer::CoreCommand> {};
+template <> struct TTypedValue<EProperty::ENV> :
+    TTypedField<TTuple, &TContainer::EnvCfg> {};
+template <> struct TTypedValue<EProperty::PORTO_NAMESPACE> :
+    TTypedField<std::string, &TContainer::NsName> {};
+template <> struct TTypedValue<EProperty::PLACE> :
+    TTypedField<TTuple, &TContainer::Place> {};
+template <> struct TTypedValue<EProperty::ROOT> :
+    TTypedField<std::string, &TContainer::Root> {};
+template <> struct TTypedValue<EProperty::ROOT_RDONLY> :
+    TTypedField<bool, &TContainer::RootRo> {};
+template <> struct TTypedValue<EProperty::HOSTNAME> :
+    TTypedField<std::string, &TContainer::Hostname> {};
+template <> struct TTypedValue<EProperty::ISOLATE> :
+    TTypedField<bool, &TContainer::Isolate> {};
+template <> struct TTypedValue<EProperty::BIND_DNS> :
+    TTypedField<bool, &TContainer::BindDns> {};
+template <> struct TTypedValue<EProperty::RESOLV_CONF> :
+    TTypedField<std::string, &TContainer::ResolvConf> {};
+template <> struct TTypedValue<EProperty::IP> :
+    TTypedField<TMultiTuple, &TContainer::IpList> {};
+template <> struct TTypedValue<EProperty::IP_LIMIT> :
+    TTypedField<TTuple, &TContainer::IpLimit> {};
+template <> struct TTypedValue<EProperty::DEFAULT_GW> :
+    TTypedField<TMultiTuple, &TContainer::DefaultGw> {};
+template <> struct TTypedValue<EProperty::ULIMIT> :
+    TTypedField<TStringMap, &TContainer::Ulimit> {};
+template <> struct TTypedValue<EProperty::SYSCTL> :
+    TTypedField<TStringMap, &TContainer::Sysctl> {};
+template <> struct TTypedValue<EProperty::CAPABILITIES> :
+    TTypedField<TCapabilities, &TContainer::CapLimit> {};
+template <> struct TTypedValue<EProperty::CAPABILITIES_AMBIENT> :
+    TTypedField<TCapabilities, &TContainer::CapAmbient> {};
+template <> struct TTypedValue<EProperty::CONTROLLERS> :
+    TTypedField<uint64_t, &TContainer::Controllers> {};
+template <> struct TTypedValue<EProperty::RESPAWN> :
+    TTypedField<bool, &TContainer::ToRespawn> {};
+template <> struct TTypedValue<EProperty::MAX_RESPAWNS> :
+    TTypedField<int, &TContainer::MaxRespawns> {};
+template <> struct TTypedValue<EProperty::PRIVATE> :
+    TTypedField<std::string, &TContainer::Private> {};
+template <> struct TTypedValue<EProperty::AGING_TIME> :
+    TTypedField<uint64_t, &TContainer::AgingTime> {};
+template <> struct TTypedValue<EProperty::WEAK> :
+    TTypedField<bool, &TContainer::IsWeak> {};
+template <> struct TTypedValue<EProperty::OOM_IS_FATAL> :
+    TTypedField<bool, &TContainer::OomIsFatal> {};
+template <> struct TTypedValue<EProperty::OOM_SCORE_ADJ> :
+    TTypedField<int, &TContainer::OomScoreAdj> {};
+template <> struct TTypedValue<EProperty::MEM_LIMIT> :
+    TTypedField<uint64_t, &TContainer::MemLimit, CGROUP_MEMORY> {};
+template <> struct TTypedValue<EProperty::ANON_LIMIT> :
+    TTypedField<uint64_t, &TContainer::AnonMemLimit, CGROUP_MEMORY> {};
+template <> struct TTypedValue<EProperty::DIRTY_LIMIT> :
+    TTypedField<uint64_t, &TContainer::DirtyMemLimit, CGROUP_MEMORY> {};
+template <> struct TTypedValue<EProperty::RECHARGE_ON_PGFAULT> :
+    TTypedField<bool, &TContainer::RechargeOnPgfault, CGROUP_MEMORY> {};
+template <> struct TTypedValue<EProperty::PRESSURIZE_ON_DEATH> :
+    TTypedField<bool, &TContainer::PressurizeOnDeath> {};
+template <> struct TTypedValue<EProperty::CPU_LIMIT> :
+    TTypedField<double, &TContainer::CpuLimit, CGROUP_CPU> {};
+template <> struct TTypedValue<EProperty::CPU_GUARANTEE> :
+    TTypedField<double, &TContainer::CpuGuarantee, CGROUP_CPU> {};
+template <> struct TTypedValue<EProperty::CPU_PERIOD> :
+    TTypedField<uint64_t, &TContainer::CpuPeriod, CGROUP_CPU> {};
+template <> struct TTypedValue<EProperty::IO_WEIGHT> :
+    TTypedField<double, &TContainer::IoWeight, CGROUP_BLKIO> {};
+template <> struct TTypedValue<EProperty::IO_LIMIT> :
+    TTypedIoLimit<&TContainer::IoBpsLimit> {};
+template <> struct TTypedValue<EProperty::IO_OPS_LIMIT> :
+    TTypedIoLimit<&TContainer::IoOpsLimit> {};
+template <> struct TTypedValue<EProperty::THREAD_LIMIT> :
+    TTypedField<uint64_t, &TContainer::ThreadLimit, CGROUP_PIDS> {};
+template <> struct TTypedValue<EProperty::DEVICES> :
+    TTypedField<TMultiTuple, &TContainer::Devices, CGROUP_DEVICES> {};
+template <> struct TTypedValue<EProperty::NET_GUARANTEE> :
+    TTypedNetClass<&TNetClass::Rate> {};
+template <> struct TTypedValue<EProperty::NET_LIMIT> :
+    TTypedNetClass<&TNetClass::Limit> {};
+template <> struct TTypedValue<EProperty::NET_RX_LIMIT> :
+    TTypedNetClass<&TNetClass::RxLimit> {};
+template <> struct TTypedValue<EProperty::NET_PRIO> :
+    TTypedNetClass<&TNetClass::Prio> {};
+
+/* Network config is kept together with flags derived from it */
+template <> struct TTypedValue<EProperty::NET> {
+    enum {
+        NET_ISOLATE = 1,
+        NET_INHERIT = 2,
+    };
+    static void Save(kv::TValue &value) {
+        EncodeValue(value, CT->NetProp);
+        value.set_u64((CT->NetIsolate ? NET_ISOLATE : 0) |
+                      (CT->NetInherit ? NET_INHERIT : 0));
+    }
+    static TError Load(const TProperty &prop, const kv::TValue &value) {
+        DecodeValue(value, CT->NetProp);
+        CT->NetIsolate = value.u64() & NET_ISOLATE;
+        CT->NetInherit = value.u64() & NET_INHERIT;
+        return prop.WantControllers(CT->NetInherit ? 0 : CGROUP_NETCLS);
+    }
+};
+
+struct TTypedCodec {
+    void (*Save)(kv::TValue &value);
+    TError (*Load)(const TProperty &prop, const kv::TValue &value);
+};
+
+static TTypedCodec TypedCodecs[(int)EProperty::NR_PROPERTIES];
+
+template <EProperty P>
+static void RegisterTyped(void) {
+    TypedCodecs[(int)P] = { TTypedValue<P>::Save, TTypedValue<P>::Load };
+}
+
+template <EProperty P1, EProperty P2, EProperty... Rest>
+static void RegisterTyped(void) {
+    RegisterTyped<P1>();
+    RegisterTyped<P2, Rest...>();
+}
+
+bool TProperty::IsTyped(void) const {
+    return TypedCodecs[(int)Prop].Save != nullptr;
+}
+
+void TProperty::GetTyped(kv::TValue &value) const {
+    TypedCodecs[(int)Prop].Save(value);
+}
+
+TError TProperty::SetTyped(const kv::TValue &value) const {
+    auto &codec = TypedCodecs[(int)Prop];
+    if (!codec.Load)
+        return TError(EError::Unknown, "Property has no typed value: " + Name);
+    return codec.Load(*this, value);
+}
+
 void InitContainerProperties(void) {
     for (auto prop: ContainerProperties)
         prop.second->Init();
+
+    RegisterTyped<
+        EProperty::COMMAND,
+        EProperty::CORE_COMMAND,
+        EProperty::ENV,
+        EProperty::PORTO_NAMESPACE,
+        EProperty::PLACE,
+        EProperty::ROOT,
+        EProperty::ROOT_RDONLY,
+        EProperty::HOSTNAME,
+        EProperty::ISOLATE,
+        EProperty::BIND_DNS,
+        EProperty::RESOLV_CONF,
+        EProperty::NET,
+        EProperty::IP,
+        EProperty::IP_LIMIT,
+        EProperty::DEFAULT_GW,
+        EProperty::ULIMIT,
+        EProperty::SYSCTL,
+        EProperty::CAPABILITIES,
+        EProperty::CAPABILITIES_AMBIENT,
+        EProperty::CONTROLLERS,
+        EProperty::RESPAWN,
+        EProperty::MAX_RESPAWNS,
+        EProperty::PRIVATE,
+        EProperty::AGING_TIME,
+        EProperty::WEAK,
+        EProperty::OOM_IS_FATAL,
+        EProperty::OOM_SCORE_ADJ,
+        EProperty::MEM_LIMIT,
+        EProperty::ANON_LIMIT,
+        EProperty::DIRTY_LIMIT,
+        EProperty::RECHARGE_ON_PGFAULT,
+        EProperty::PRESSURIZE_ON_DEATH,
+        EProperty::CPU_LIMIT,
+        EProperty::CPU_GUARANTEE,
+        EProperty::CPU_PERIOD,
+        EProperty::IO_WEIGHT,
+        EProperty::IO_LIMIT,
+        EProperty::IO_OPS_LIMIT,
+        EProperty::THREAD_LIMIT,
+        EProperty::DEVICES,
+        EProperty::NET_GUARANTEE,
+        EProperty::NET_LIMIT,
+        EProperty::NET_RX_LIMIT,
+        EProperty::NET_PRIO
+    >();
 }
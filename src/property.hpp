@@ -206,6 +206,10 @@ enum class EProperty {
     NR_PROPERTIES,
 };
 
+namespace kv {
+    class TValue;
+}
+
 constexpr const char *P_VIRT_MODE_APP = "app";
 constexpr const char *P_VIRT_MODE_OS = "os";
 constexpr int VIRT_MODE_APP = 0;
@@ -239,6 +243,11 @@ public:
     virtual TError GetToSave(std::string &value);
     virtual TError SetFromRestore(const std::string &value);
 
+    /* Native form for key-value storage, if property has one */
+    bool IsTyped(void) const;
+    void GetTyped(kv::TValue &value) const;
+    TError SetTyped(const kv::TValue &value) const;
+
     virtual TError Start(void);
 };
 
@@ -14,6 +14,9 @@
 #include "util/cred.hpp"
 #include "portod.hpp"
 #include "storage.hpp"
+#include "notify.hpp"
+#include "operation.hpp"
+#include "trace.hpp"
 
 extern "C" {
 #include <sys/stat.h>
@@ -75,6 +78,29 @@ static std::string RequestAsString(const rpc::TContainerRequest &req) {
             ret += " timeout " + std::to_string(req.wait().timeout());
 
         return ret;
+    } else if (req.has_subscribe()) {
+        std::string ret = "subscribe";
+
+        for (int i = 0; i < req.subscribe().name_size(); i++)
+            ret += " " + req.subscribe().name(i);
+
+        if (req.subscribe().has_since())
+            ret += " since " + std::to_string(req.subscribe().since());
+
+        return ret;
+    } else if (req.has_unsubscribe()) {
+        return "unsubscribe";
+    } else if (req.has_operation()) {
+        std::string ret = "operation " + std::to_string(req.operation().id());
+
+        if (req.operation().cancel())
+            ret += " cancel";
+        if (req.operation().has_timeout())
+            ret += " timeout " + std::to_string(req.operation().timeout());
+
+        return ret;
+    } else if (req.has_trace()) {
+        return req.trace().slowest() ? "trace slowest" : "trace";
     } else if (req.has_createvolume()) {
         std::string ret = "create volume " + req.createvolume().path();
         for (auto p: req.createvolume().properties())
@@ -183,7 +209,94 @@ static bool SilentRequest(const rpc::TContainerRequest &req) {
         req.has_convertpath() ||
         req.has_getlayerprivate() ||
         req.has_liststorage() ||
-        req.has_locateprocess();
+        req.has_locateprocess() ||
+        req.has_subscribe() ||
+        req.has_unsubscribe() ||
+        (req.has_operation() && !req.operation().cancel()) ||
+        req.has_trace();
+}
+
+static bool HeavyRequest(const rpc::TContainerRequest &req) {
+    return
+        req.has_createvolume() ||
+        req.has_unlinkvolume() ||
+        req.has_tunevolume() ||
+        req.has_importlayer() ||
+        req.has_exportlayer() ||
+        req.has_removelayer() ||
+        req.has_removestorage() ||
+        req.has_importstorage() ||
+        req.has_exportstorage();
+}
+
+ERequestClass RequestClass(const rpc::TContainerRequest &req) {
+    if (SilentRequest(req))
+        return RequestRead;
+
+    /* async request only queues operation into I/O executor */
+    if (HeavyRequest(req))
+        return req.async() ? RequestWrite : RequestHeavy;
+
+    return RequestWrite;
+}
+
+const char *RequestTypeName[NR_REQUEST_TYPES] = {
+    "create",
+    "destroy",
+    "list",
+    "get",
+    "getproperty",
+    "setproperty",
+    "getdata",
+    "start",
+    "stop",
+    "kill",
+    "wait",
+    "create_volume",
+    "link_volume",
+    "unlink_volume",
+    "list_volumes",
+    "import_layer",
+    "remove_layer",
+    "other",
+};
+
+ERequestType RequestType(const rpc::TContainerRequest &req) {
+    if (req.has_create() || req.has_createweak())
+        return RequestCreate;
+    if (req.has_destroy())
+        return RequestDestroy;
+    if (req.has_list())
+        return RequestList;
+    if (req.has_get())
+        return RequestGet;
+    if (req.has_getproperty())
+        return RequestGetProperty;
+    if (req.has_setproperty())
+        return RequestSetProperty;
+    if (req.has_getdata())
+        return RequestGetData;
+    if (req.has_start())
+        return RequestStart;
+    if (req.has_stop())
+        return RequestStop;
+    if (req.has_kill())
+        return RequestKill;
+    if (req.has_wait())
+        return RequestWait;
+    if (req.has_createvolume())
+        return RequestCreateVolume;
+    if (req.has_linkvolume())
+        return RequestLinkVolume;
+    if (req.has_unlinkvolume())
+        return RequestUnlinkVolume;
+    if (req.has_listvolumes())
+        return RequestListVolumes;
+    if (req.has_importlayer())
+        return RequestImportLayer;
+    if (req.has_removelayer())
+        return RequestRemoveLayer;
+    return RequestOther;
 }
 
 static bool ValidRequest(const rpc::TContainerRequest &req) {
@@ -223,7 +336,11 @@ static bool ValidRequest(const rpc::TContainerRequest &req) {
         req.has_removestorage() +
         req.has_importstorage() +
         req.has_exportstorage() +
-        req.has_locateprocess() == 1;
+        req.has_locateprocess() +
+        req.has_subscribe() +
+        req.has_unsubscribe() +
+        req.has_operation() +
+        req.has_trace() == 1;
 }
 
 static TError CheckPortoWriteAccess() {
@@ -302,17 +419,75 @@ noinline TError ResumeContainer(const rpc::TContainerResumeRequest &req) {
     return ct->Resume();
 }
 
+/*
+ * Streaming: listing is ordered, chunk ends after max_count entries and
+ * continuation token is the client name of last entry, next chunk starts
+ * right after it. Thus server keeps no state between chunks.
+ */
+static TError StreamStart(bool has_continuation, const std::string &continuation,
+                          std::string &from) {
+    if (!has_continuation)
+        return TError::Success();
+    if (continuation.empty())
+        return TError(EError::InvalidValue, "Empty continuation token");
+    return CL->ResolveName(continuation, from);
+}
+
+/* absolute name prefix shared by all names matching any of masks */
+static std::string MasksPrefix(const std::list<std::string> &masks) {
+    std::string prefix;
+
+    for (auto it = masks.begin(); it != masks.end(); ++it) {
+        std::string literal = TContainerWaiter::WildcardPrefix(*it);
+        if (it == masks.begin()) {
+            prefix = literal;
+            continue;
+        }
+        size_t len = 0;
+        while (len < prefix.size() && len < literal.size() &&
+                prefix[len] == literal[len])
+            len++;
+        prefix.resize(len);
+    }
+
+    return CL->PortoNamespace + prefix;
+}
+
+/* first container under prefix after continuation token */
+static std::map<std::string, std::shared_ptr<TContainer>>::iterator
+ContainersFrom(const std::string &prefix, const std::string &from) {
+    if (from < prefix)
+        return Containers.lower_bound(prefix);
+    return Containers.upper_bound(from);
+}
+
 noinline TError ListContainers(const rpc::TContainerListRequest &req,
                                rpc::TContainerResponse &rsp) {
     std::string mask = req.has_mask() ? req.mask() : "***";
+    auto list = rsp.mutable_list();
+    std::string from, last;
+
+    TError error = StreamStart(req.has_continuation(), req.continuation(), from);
+    if (error)
+        return error;
+
+    /* names of porto namespace and literal prefix of mask are adjacent */
+    std::string prefix = MasksPrefix({mask});
+
     auto lock = LockContainers();
-    for (auto &it: Containers) {
-        auto &ct = it.second;
+    for (auto it = ContainersFrom(prefix, from);
+            it != Containers.end() && StringStartsWith(it->first, prefix); ++it) {
+        auto &ct = it->second;
         std::string name;
         if (ct->IsRoot() || CL->ComposeName(ct->Name, name) ||
                 !StringMatch(name, mask))
             continue;
-        rsp.mutable_list()->add_name(name);
+        if (req.max_count() && list->name_size() >= (int)req.max_count()) {
+            list->set_continuation(last);
+            break;
+        }
+        list->add_name(name);
+        last = name;
     }
     return TError::Success();
 }
@@ -333,7 +508,7 @@ noinline TError GetContainerProperty(const rpc::TContainerGetPropertyRequest &re
         if (req.has_sync() && req.sync())
             ct->SyncProperty(req.property());
 
-        error = ct->GetProperty(req.property(), value);
+        error = ct->GetProperty(req.property(), value, req.has_sync() && req.sync());
         if (!error)
             rsp.mutable_getproperty()->set_value(value);
     }
@@ -388,22 +563,64 @@ noinline TError GetContainerData(const rpc::TContainerGetDataRequest &req,
         if (req.has_sync() && req.sync())
             ct->SyncProperty(req.data());
 
-        error = ct->GetProperty(req.data(), value);
+        error = ct->GetProperty(req.data(), value, req.has_sync() && req.sync());
         if (!error)
             rsp.mutable_getdata()->set_value(value);
     }
     return error;
 }
 
+/* nearest existing container which contains all named, under ContainersMutex */
+static std::shared_ptr<TContainer> CommonAncestor(const std::list<std::string> &names) {
+    std::string common;
+    bool first = true;
+
+    for (auto &relative_name: names) {
+        std::string name;
+        if (CL->ResolveName(relative_name, name) || name == ROOT_CONTAINER)
+            return RootContainer;
+        if (first) {
+            common = name;
+            first = false;
+        }
+        while (common != ROOT_CONTAINER && name != common &&
+                !StringStartsWith(name, common + "/"))
+            common = TContainer::ParentName(common);
+    }
+
+    for (; common != ROOT_CONTAINER && !first; common = TContainer::ParentName(common)) {
+        auto ct = TContainer::Find(common);
+        if (ct)
+            return ct;
+    }
+
+    return RootContainer;
+}
+
 static void FillGetResponse(const rpc::TContainerGetRequest &req,
                             rpc::TContainerGetResponse &rsp,
-                            std::string &name) {
+                            std::string &name, bool snapshot) {
+    std::shared_ptr<const TContainerSnapshot> snap;
     std::shared_ptr<TContainer> ct;
 
     auto lock = LockContainers();
     TError containerError = CL->ResolveContainer(name, ct);
+
+    /* container without snapshot yet is read under its own lock */
+    if (!containerError && snapshot) {
+        snap = ct->GetSnapshot();
+        if (!snap) {
+            containerError = ct->LockRead(lock, req.has_nonblock() && req.nonblock());
+            if (containerError)
+                ct = nullptr;
+        }
+    }
+
     lock.unlock();
 
+    /* statistics are read and parsed once for all variables */
+    TCgroupStatContext statContext;
+
     auto entry = rsp.add_list();
     entry->set_name(name);
     for (int j = 0; j < req.variable_size(); j++) {
@@ -415,8 +632,12 @@ static void FillGetResponse(const rpc::TContainerGetRequest &req,
         TError error = containerError;
         if (!error && req.has_real() && req.real())
             error = ct->HasProperty(var);
-        if (!error)
-            error = ct->GetProperty(var, value);
+        if (!error && snap) {
+            auto &prop = snap->Properties.at(var);
+            error = prop.first;
+            value = prop.second;
+        } else if (!error)
+            error = ct->GetProperty(var, value, req.has_sync() && req.sync());
 
         keyval->set_variable(var);
         if (error) {
@@ -426,6 +647,9 @@ static void FillGetResponse(const rpc::TContainerGetRequest &req,
             keyval->set_value(value);
         }
     }
+
+    if (snapshot && ct && !snap)
+        ct->Unlock();
 }
 
 noinline TError GetContainerCombined(const rpc::TContainerGetRequest &req,
@@ -433,48 +657,81 @@ noinline TError GetContainerCombined(const rpc::TContainerGetRequest &req,
     bool try_lock = req.has_nonblock() && req.nonblock();
     auto get = rsp.mutable_get();
     std::list <std::string> masks, names;
+    std::string from, last;
+
+    TError error = StreamStart(req.has_continuation(), req.continuation(), from);
+    if (error)
+        return error;
 
+    /* explicit names are returned in the first chunk */
     for (int i = 0; i < req.name_size(); i++) {
         auto name = req.name(i);
-        if (name.find_first_of("*?") == std::string::npos)
-            names.push_back(name);
-        else
+        if (name.find_first_of("*?") != std::string::npos)
             masks.push_back(name);
+        else if (!req.has_continuation())
+            names.push_back(name);
     }
 
     if (!masks.empty()) {
+        std::string prefix = MasksPrefix(masks);
+        uint32_t count = 0;
         auto lock = LockContainers();
-        for (auto &it: Containers) {
-            auto &ct = it.second;
+        for (auto it = ContainersFrom(prefix, from);
+                it != Containers.end() && StringStartsWith(it->first, prefix); ++it) {
+            auto &ct = it->second;
             std::string name;
             if (ct->IsRoot() || CL->ComposeName(ct->Name, name))
                 continue;
-            if (masks.empty())
-                names.push_back(name);
             for (auto &mask: masks) {
                 if (StringMatch(name, mask)) {
+                    if (req.max_count() && count >= req.max_count()) {
+                        get->set_continuation(last);
+                        break;
+                    }
                     names.push_back(name);
+                    last = name;
+                    count++;
                     break;
                 }
             }
+            if (get->has_continuation())
+                break;
         }
     }
 
-    /* Lock all containers for read. TODO: lock only common ancestor */
+    bool sync = req.has_sync() && req.sync();
+    bool real = req.has_real() && req.real();
+
+    /* Read-mostly properties are served from snapshots without locks */
+    bool snapshot = !sync && !real && req.variable_size();
+    for (int i = 0; snapshot && i < req.variable_size(); i++)
+        snapshot = TContainer::IsSnapshotProperty(req.variable(i));
+
+    if (snapshot) {
+        for (auto &name: names)
+            FillGetResponse(req, *get, name, true);
+        return TError::Success();
+    }
+
+    /*
+     * Lock common ancestor of requested containers for read,
+     * with lazy restore request waits only for this subtree.
+     */
 
     auto lock = LockContainers();
-    TError error = RootContainer->LockRead(lock, try_lock);
+    auto ancestor = sync ? RootContainer : CommonAncestor(names);
+    error = ancestor->LockRead(lock, try_lock);
     lock.unlock();
     if (error)
         return error;
 
-    if (req.has_sync() && req.sync())
+    if (sync)
         TContainer::SyncPropertiesAll();
 
     for (auto &name: names)
-        FillGetResponse(req, *get, name);
+        FillGetResponse(req, *get, name, false);
 
-    RootContainer->Unlock();
+    ancestor->Unlock();
 
     return TError::Success();
 }
@@ -525,7 +782,8 @@ noinline TError Version(rpc::TContainerResponse &rsp) {
 
 noinline TError Wait(const rpc::TContainerWaitRequest &req,
                      rpc::TContainerResponse &rsp,
-                     std::shared_ptr<TClient> &client) {
+                     std::shared_ptr<TClient> &client,
+                     const rpc::TContainerRequest &request) {
     auto lock = LockContainers();
     bool queueWait = !req.has_timeout() || req.timeout() != 0;
 
@@ -534,6 +792,10 @@ noinline TError Wait(const rpc::TContainerWaitRequest &req,
 
     auto waiter = std::make_shared<TContainerWaiter>(client);
 
+    /* response is sent later, remember tag of pipelined request */
+    waiter->Pipelined = request.has_reqid();
+    waiter->RequestId = request.reqid();
+
     for (int i = 0; i < req.name_size(); i++) {
         std::string name = req.name(i);
         std::string abs_name;
@@ -563,9 +825,14 @@ noinline TError Wait(const rpc::TContainerWaitRequest &req,
             ct->AddWaiter(waiter);
     }
 
-    if (!waiter->Wildcards.empty()) {
-        for (auto &it: Containers) {
-            auto &ct = it.second;
+    for (auto &wildcard: waiter->Wildcards) {
+        /* scan only names which share literal prefix */
+        std::string prefix = client->PortoNamespace +
+                             TContainerWaiter::WildcardPrefix(wildcard);
+
+        for (auto it = Containers.lower_bound(prefix);
+                it != Containers.end() && StringStartsWith(it->first, prefix); ++it) {
+            auto &ct = it->second;
             if (ct->IsRoot())
                 continue;
 
@@ -577,22 +844,22 @@ noinline TError Wait(const rpc::TContainerWaitRequest &req,
 
             std::string name;
             if (!client->ComposeName(ct->Name, name) &&
-                    waiter->MatchWildcard(name)) {
+                    StringMatch(name, wildcard)) {
                 rsp.mutable_wait()->set_name(name);
                 return TError::Success();
             }
         }
-
-        if (queueWait)
-            TContainerWaiter::AddWildcard(waiter);
     }
 
+    if (!waiter->Wildcards.empty() && queueWait)
+        TContainerWaiter::AddWildcard(waiter, client->PortoNamespace);
+
     if (!queueWait) {
         rsp.mutable_wait()->set_name("");
         return TError::Success();
     }
 
-    client->Waiter = waiter;
+    client->Waiters.push_back(waiter);
 
     if (req.has_timeout()) {
         TEvent e(EEventType::WaitTimeout, nullptr);
@@ -795,18 +1062,33 @@ noinline TError ListVolumes(const rpc::TVolumeListRequest &req,
         return TError::Success();
     }
 
+    TPath from;
+    if (req.has_continuation()) {
+        if (req.continuation().empty())
+            return TError(EError::InvalidValue, "Empty continuation token");
+        from = CL->ResolvePath(req.continuation());
+    }
+
     auto volumes_lock = LockVolumes();
     std::list<std::shared_ptr<TVolume>> list;
-    for (auto &it : Volumes) {
-        auto volume = it.second;
+    for (auto it = Volumes.upper_bound(from); it != Volumes.end(); ++it) {
+        auto volume = it->second;
 
         if (req.has_container() &&
                 std::find(volume->Containers.begin(), volume->Containers.end(),
                     req.container()) == volume->Containers.end())
             continue;
 
-        if (!CL->ComposePath(volume->Path).IsEmpty())
-            list.push_back(volume);
+        if (CL->ComposePath(volume->Path).IsEmpty())
+            continue;
+
+        if (req.max_count() && list.size() >= req.max_count()) {
+            auto last = CL->ComposePath(list.back()->Path);
+            rsp.mutable_volumelist()->set_continuation(last.ToString());
+            break;
+        }
+
+        list.push_back(volume);
     }
     volumes_lock.unlock();
 
@@ -818,6 +1100,77 @@ noinline TError ListVolumes(const rpc::TVolumeListRequest &req,
     return TError::Success();
 }
 
+noinline TError Subscribe(const rpc::TSubscribeRequest &req,
+                          std::shared_ptr<TClient> &client,
+                          const rpc::TContainerRequest &request) {
+    /* untagged request would block all following requests */
+    if (!request.has_reqid())
+        return TError(EError::InvalidValue, "Subscribe requires tagged request");
+
+    TError error = NotifyLog.Subscribe(client, req, request);
+    if (error)
+        return error;
+
+    /* events are pushed as responses until unsubscribe */
+    return TError::Queued();
+}
+
+noinline TError Unsubscribe(std::shared_ptr<TClient> &client) {
+    return NotifyLog.Unsubscribe(*client);
+}
+
+noinline TError StartOperation(const rpc::TContainerRequest &req,
+                               rpc::TContainerResponse &rsp,
+                               std::shared_ptr<TClient> &client) {
+    if (!HeavyRequest(req))
+        return TError(EError::InvalidValue, "Request cannot be async");
+
+    auto op = std::make_shared<TOperation>(client, req);
+    TError error = TOperation::Queue(op);
+    if (error)
+        return error;
+
+    rsp.mutable_operation()->set_id(op->Id);
+    rsp.mutable_operation()->set_state("queued");
+
+    return TError::Success();
+}
+
+noinline TError GetOperation(const rpc::TOperationRequest &req,
+                             rpc::TContainerResponse &rsp,
+                             std::shared_ptr<TClient> &client,
+                             const rpc::TContainerRequest &request) {
+    auto op = TOperation::Find(req.id());
+    if (!op)
+        return TError(EError::InvalidValue, "Operation " + std::to_string(req.id()) + " not found");
+
+    if (op->Owner.Uid != CL->Cred.Uid && !CL->IsSuperUser())
+        return TError(EError::Permission, "Operation belongs to other user");
+
+    if (req.cancel()) {
+        TError error = CheckPortoWriteAccess();
+        if (error)
+            return error;
+        op->Cancel();
+    }
+
+    return op->Wait(client, request, req.timeout(), rsp);
+}
+
+noinline TError DumpTrace(const rpc::TTraceRequest &req,
+                          rpc::TContainerResponse &rsp) {
+    /* traces show requests of all clients */
+    if (!CL->IsSuperUser())
+        return TError(EError::Permission, "Only superuser could see request traces");
+
+    if (!config().daemon().request_trace())
+        return TError(EError::NotSupported, "Request tracing is disabled");
+
+    TraceLog.Dump(*rsp.mutable_trace(), req.slowest());
+
+    return TError::Success();
+}
+
 noinline TError ImportLayer(const rpc::TLayerImportRequest &req) {
     TError error = CheckPortoWriteAccess();
     if (error)
@@ -831,9 +1184,13 @@ noinline TError ImportLayer(const rpc::TLayerImportRequest &req) {
 
     layer.Owner = CL->Cred;
 
-    return layer.ImportArchive(CL->ResolvePath(req.tarball()),
-                               req.has_compress() ? req.compress() : "",
-                               req.merge());
+    error = layer.ImportArchive(CL->ResolvePath(req.tarball()),
+                                req.has_compress() ? req.compress() : "",
+                                req.merge());
+    if (!error)
+        NotifyLog.Publish(ENotifyObject::Layer, "layer_import", layer.Name,
+                          "", layer.Place.ToString());
+    return error;
 }
 
 noinline TError GetLayerPrivate(const rpc::TLayerGetPrivateRequest &req,
@@ -910,7 +1267,11 @@ noinline TError RemoveLayer(const rpc::TLayerRemoveRequest &req) {
 
     TStorage layer(req.has_place() ? req.place() : CL->DefaultPlace(),
                    PORTO_LAYERS, req.layer());
-    return layer.Remove();
+    error = layer.Remove();
+    if (!error)
+        NotifyLog.Publish(ENotifyObject::Layer, "layer_remove", layer.Name,
+                          "", layer.Place.ToString());
+    return error;
 }
 
 noinline TError ListLayers(const rpc::TLayerListRequest &req,
@@ -925,10 +1286,21 @@ noinline TError ListLayers(const rpc::TLayerListRequest &req,
     if (error)
         return error;
 
+    /* only names are read here, layers are loaded in chunks */
+    if (req.has_max_count() || req.has_continuation())
+        layers.sort([](const TStorage &a, const TStorage &b) {
+                return a.Name < b.Name; });
+
     auto list = rsp.mutable_layers();
     for (auto &layer: layers) {
         if (req.has_mask() && !StringMatch(layer.Name, req.mask()))
             continue;
+        if (req.has_continuation() && layer.Name <= req.continuation())
+            continue;
+        if (req.max_count() && list->layer_size() >= (int)req.max_count()) {
+            list->set_continuation(list->layer(list->layer_size() - 1));
+            break;
+        }
         list->add_layer(layer.Name);
         (void)layer.Load();
         auto desc = list->add_layers();
@@ -1004,6 +1376,9 @@ noinline TError AttachProcess(const rpc::TAttachProcessRequest &req) {
             goto undo;
     }
 
+    /* cached container of pid is no longer valid */
+    TClient::InvalidateIdentity();
+
     return TError::Success();
 
 undo:
@@ -1115,28 +1490,12 @@ noinline TError ExportStorage(const rpc::TStorageExportRequest &req) {
                                  req.has_compress() ? req.compress() : "");
 }
 
-void HandleRpcRequest(const rpc::TContainerRequest &req,
-                      std::shared_ptr<TClient> client) {
-    rpc::TContainerResponse rsp;
-    std::string str;
-
-    client->StartRequest();
-
-    bool silent = !Verbose && SilentRequest(req);
-    if (!silent)
-        L_REQ("{} from {}", RequestAsString(req), client->Id);
-
-    if (Debug)
-        L_REQ("{} from {}", req.ShortDebugString(), client->Id);
-
-    rsp.set_error(EError::Unknown);
-
+static TError DispatchRequest(const rpc::TContainerRequest &req,
+                              rpc::TContainerResponse &rsp,
+                              std::shared_ptr<TClient> &client) {
     TError error;
     try {
-        if (!ValidRequest(req)) {
-            L_ERR("Invalid request {} from {}", req.ShortDebugString(), client->Id);
-            error = TError(EError::InvalidMethod, "invalid request");
-        } else if (req.has_create())
+        if (req.has_create())
             error = CreateContainer(req.create().name(), false);
         else if (req.has_createweak())
             error = CreateContainer(req.createweak().name(), true);
@@ -1169,7 +1528,7 @@ void HandleRpcRequest(const rpc::TContainerRequest &req,
         else if (req.has_version())
             error = Version(rsp);
         else if (req.has_wait())
-            error = Wait(req.wait(), rsp, client);
+            error = Wait(req.wait(), rsp, client, req);
         else if (req.has_listvolumeproperties())
             error = ListVolumeProperties(rsp);
         else if (req.has_createvolume())
@@ -1208,6 +1567,14 @@ void HandleRpcRequest(const rpc::TContainerRequest &req,
             error = ExportStorage(req.exportstorage());
         else if (req.has_locateprocess())
             error = LocateProcess(req.locateprocess(), rsp);
+        else if (req.has_subscribe())
+            error = Subscribe(req.subscribe(), client, req);
+        else if (req.has_unsubscribe())
+            error = Unsubscribe(client);
+        else if (req.has_operation())
+            error = GetOperation(req.operation(), rsp, client, req);
+        else if (req.has_trace())
+            error = DumpTrace(req.trace(), rsp);
         else
             error = TError(EError::InvalidMethod, "invalid RPC method");
     } catch (std::bad_alloc exc) {
@@ -1224,6 +1591,41 @@ void HandleRpcRequest(const rpc::TContainerRequest &req,
         error = TError(EError::Unknown, "unknown error");
     }
 
+
+    return error;
+}
+
+void HandleRpcRequest(const rpc::TContainerRequest &req,
+                      std::shared_ptr<TClient> client) {
+    rpc::TContainerResponse rsp;
+    std::string str;
+
+    client->StartRequest();
+
+    bool silent = !Verbose && SilentRequest(req);
+    if (!silent)
+        L_REQ("{} from {}", RequestAsString(req), client->Id);
+
+    if (Debug)
+        L_REQ("{} from {}", req.ShortDebugString(), client->Id);
+
+    auto trace = TRequestTrace::Current;
+    if (trace) {
+        trace->Request = RequestAsString(req);
+        trace->Client = client->Id;
+    }
+
+    rsp.set_error(EError::Unknown);
+
+    TError error;
+    if (!ValidRequest(req)) {
+        L_ERR("Invalid request {} from {}", req.ShortDebugString(), client->Id);
+        error = TError(EError::InvalidMethod, "invalid request");
+    } else if (req.async())
+        error = StartOperation(req, rsp, client);
+    else
+        error = DispatchRequest(req, rsp, client);
+
     client->FinishRequest();
 
     if (error.GetError() != EError::Queued) {
@@ -1243,21 +1645,46 @@ void HandleRpcRequest(const rpc::TContainerRequest &req,
         if (Debug)
             L_RSP("{} to {}", rsp.ShortDebugString(), client->Id);
 
+        if (req.has_reqid())
+            rsp.set_reqid(req.reqid());
+
+        if (trace)
+            trace->Error = rsp.error();
+
+        TTraceScope traceSend(TraceSend);
         error = client->QueueResponse(rsp);
         if (error)
             L_WRN("Cannot send response for {} : {}", client->Id, error);
     }
 }
 
-void SendWaitResponse(TClient &client, const std::string &name) {
+void ExecuteOperation(TOperation &op) {
+    auto client = op.Client;
+    TError error;
+
+    client->StartRequest();
+    error = DispatchRequest(op.Request, op.Result, client);
+    client->FinishRequest();
+
+    op.Result.set_error(error.GetError());
+    op.Result.set_errormsg(error.GetMsg());
+
+    L_RSP("{} to {} (operation {} took {} ms)", ResponseAsString(op.Result),
+          client->Id, op.Id, client->RequestTimeMs);
+}
+
+void SendWaitResponse(TClient &client, const TContainerWaiter &waiter,
+                      const std::string &name) {
     rpc::TContainerResponse rsp;
 
     rsp.set_error(EError::Success);
     rsp.mutable_wait()->set_name(name);
+    if (waiter.Pipelined)
+        rsp.set_reqid(waiter.RequestId);
 
     if (!name.empty() || Verbose)
         L_RSP("{} to {} (request took {} ms)", ResponseAsString(rsp),
-                client.Id, client.RequestTimeMs);
+                client.Id, GetCurrentTimeMs() - waiter.StartTimeMs);
 
     if (Debug)
         L_RSP("{} to {}", rsp.ShortDebugString(), client.Id);
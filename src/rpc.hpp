@@ -2,8 +2,26 @@
 
 #include "common.hpp"
 #include "client.hpp"
+#include "statistics.hpp"
+
+/* Order is priority for RPC workers */
+enum ERequestClass {
+    RequestRead,
+    RequestWrite,
+    RequestHeavy,
+    NR_REQUEST_CLASSES,
+};
+
+ERequestClass RequestClass(const rpc::TContainerRequest &req);
+
+extern const char *RequestTypeName[NR_REQUEST_TYPES];
+ERequestType RequestType(const rpc::TContainerRequest &req);
 
 void HandleRpcRequest(const rpc::TContainerRequest &req,
                       std::shared_ptr<TClient> client);
 
-void SendWaitResponse(TClient &client, const std::string &name);
+class TOperation;
+void ExecuteOperation(TOperation &op);
+
+void SendWaitResponse(TClient &client, const TContainerWaiter &waiter,
+                      const std::string &name);
@@ -2,6 +2,71 @@
 
 #include <atomic>
 
+/* Tracked RPC types, see RequestType() */
+enum ERequestType {
+    RequestCreate,
+    RequestDestroy,
+    RequestList,
+    RequestGet,
+    RequestGetProperty,
+    RequestSetProperty,
+    RequestGetData,
+    RequestStart,
+    RequestStop,
+    RequestKill,
+    RequestWait,
+    RequestCreateVolume,
+    RequestLinkVolume,
+    RequestUnlinkVolume,
+    RequestListVolumes,
+    RequestImportLayer,
+    RequestRemoveLayer,
+    RequestOther,
+    NR_REQUEST_TYPES,
+};
+
+/*
+ * Log2 histogram of latencies in microseconds: bucket N counts values
+ * in range [2^(N-1), 2^N), last bucket collects everything above.
+ * Lives in shared statistics, thus plain array of atomics.
+ */
+struct TLatencyHistogram {
+    static constexpr int BUCKETS = 32;
+
+    std::atomic<uint64_t> Buckets[BUCKETS];
+
+    static uint64_t BucketLimit(int bucket) {
+        return 1ull << bucket;
+    }
+
+    void Add(uint64_t us) {
+        int bucket = us ? 64 - __builtin_clzll(us) : 0;
+        if (bucket >= BUCKETS)
+            bucket = BUCKETS - 1;
+        Buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint64_t Count() const {
+        uint64_t count = 0;
+        for (auto &b: Buckets)
+            count += b.load(std::memory_order_relaxed);
+        return count;
+    }
+
+    /* Upper bound of bucket which contains given percentile */
+    uint64_t Percentile(uint64_t percent) const {
+        uint64_t count = Count(), sum = 0;
+        if (!count)
+            return 0;
+        for (int i = 0; i < BUCKETS; i++) {
+            sum += Buckets[i].load(std::memory_order_relaxed);
+            if (sum * 100 >= count * percent)
+                return BucketLimit(i);
+        }
+        return BucketLimit(BUCKETS - 1);
+    }
+};
+
 struct TStatistics {
     std::atomic<uint64_t> Spawned;
     std::atomic<uint64_t> Errors;
@@ -28,6 +93,9 @@ struct TStatistics {
     std::atomic<uint64_t> RequestsLonger3s;
     std::atomic<uint64_t> RequestsLonger30s;
     std::atomic<uint64_t> RequestsLonger5m;
+    TLatencyHistogram RequestsWait[NR_REQUEST_TYPES];
+    TLatencyHistogram RequestsExec[NR_REQUEST_TYPES];
+    TLatencyHistogram ContainersLockWait;
 };
 
 extern TStatistics *Statistics;
@@ -4,6 +4,7 @@
 #include "config.hpp"
 #include "filesystem.hpp"
 #include "client.hpp"
+#include "operation.hpp"
 #include <algorithm>
 #include <condition_variable>
 #include "util/unix.hpp"
@@ -472,7 +473,12 @@ TError TStorage::ImportArchive(const TPath &archive, const std::string &compress
                         "--xattrs-include=security.capability",
                         "--xattrs-include=trusted.overlay.*" });
 
-        error = RunCommand(args, temp, arc, TFile());
+        /* listing of extracted files is progress of async operation */
+        if (TOperation::Current && TOperation::Current->Listing.Fd >= 0) {
+            args.push_back("--verbose");
+            error = RunCommand(args, temp, arc, TOperation::Current->Listing);
+        } else
+            error = RunCommand(args, temp, arc, TFile());
     } else if (compress_format == "squashfs") {
         TTuple args = { "unsquashfs",
                         "-force",
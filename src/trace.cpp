@@ -0,0 +1,74 @@
+#include <algorithm>
+
+#include "trace.hpp"
+#include "config.hpp"
+
+#include "rpc.pb.h"
+
+__thread TRequestTrace *TRequestTrace::Current = nullptr;
+
+TTraceLog TraceLog;
+
+const char *TraceStageName[NR_TRACE_STAGES] = {
+    "recv",
+    "queue",
+    "lock",
+    "cgroup",
+    "netlink",
+    "kv",
+    "send",
+};
+
+/* heap keeps the fastest of the slowest on top */
+static bool TraceSlower(const TRequestTrace &a, const TRequestTrace &b) {
+    return a.TotalUs > b.TotalUs;
+}
+
+void TTraceLog::Add(const TRequestTrace &trace) {
+    size_t slowest = config().daemon().request_trace_slowest();
+    auto lock = ScopedLock();
+
+    Ring.push_back(trace);
+    while (Ring.size() > config().daemon().request_trace_size())
+        Ring.pop_front();
+
+    if (Slowest.size() < slowest) {
+        Slowest.push_back(trace);
+        std::push_heap(Slowest.begin(), Slowest.end(), TraceSlower);
+    } else if (slowest && trace.TotalUs > Slowest.front().TotalUs) {
+        std::pop_heap(Slowest.begin(), Slowest.end(), TraceSlower);
+        Slowest.back() = trace;
+        std::push_heap(Slowest.begin(), Slowest.end(), TraceSlower);
+    }
+}
+
+static void FillTrace(rpc::TRequestTrace *msg, const TRequestTrace &trace) {
+    msg->set_request(trace.Request);
+    msg->set_client(trace.Client);
+    msg->set_time(trace.TimeMs);
+    msg->set_total_us(trace.TotalUs);
+    msg->set_error(static_cast<rpc::EError>(trace.Error));
+
+    for (int i = 0; i < NR_TRACE_STAGES; i++) {
+        if (!trace.StageCount[i])
+            continue;
+        auto stage = msg->add_stage();
+        stage->set_name(TraceStageName[i]);
+        stage->set_time_us(trace.StageUs[i]);
+        stage->set_count(trace.StageCount[i]);
+    }
+}
+
+void TTraceLog::Dump(rpc::TTraceResponse &rsp, bool slowest) {
+    auto lock = ScopedLock();
+
+    if (slowest) {
+        auto sorted = Slowest;
+        std::sort(sorted.begin(), sorted.end(), TraceSlower);
+        for (auto &trace: sorted)
+            FillTrace(rsp.add_trace(), trace);
+    } else {
+        for (auto &trace: Ring)
+            FillTrace(rsp.add_trace(), trace);
+    }
+}
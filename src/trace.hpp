@@ -0,0 +1,79 @@
+#pragma once
+
+#include <string>
+#include <deque>
+#include <vector>
+
+#include "common.hpp"
+#include "util/locks.hpp"
+#include "util/unix.hpp"
+
+namespace rpc {
+    class TTraceResponse;
+}
+
+enum ETraceStage {
+    TraceRecv,
+    TraceQueue,
+    TraceLock,
+    TraceCgroup,
+    TraceNetlink,
+    TraceKv,
+    TraceSend,
+    NR_TRACE_STAGES,
+};
+
+extern const char *TraceStageName[NR_TRACE_STAGES];
+
+struct TRequestTrace {
+    std::string Request;
+    std::string Client;
+    uint64_t TimeMs = 0;
+    uint64_t TotalUs = 0;
+    int Error = 0;
+    uint64_t StageUs[NR_TRACE_STAGES] = {};
+    uint32_t StageCount[NR_TRACE_STAGES] = {};
+    uint32_t StageDepth[NR_TRACE_STAGES] = {};
+
+    /* trace of request handled by this thread, null if tracing is off */
+    static __thread TRequestTrace *Current;
+};
+
+/*
+ * Accounts time till the end of scope into stage of current trace.
+ * Nested scopes of the same stage are accounted only once.
+ */
+class TTraceScope : public TNonCopyable {
+    ETraceStage Stage;
+    uint64_t Start = 0;
+
+public:
+    TTraceScope(ETraceStage stage) : Stage(stage) {
+        auto trace = TRequestTrace::Current;
+        if (trace && !trace->StageDepth[stage]++)
+            Start = GetCurrentTimeUs();
+    }
+
+    ~TTraceScope() {
+        auto trace = TRequestTrace::Current;
+        if (trace && !--trace->StageDepth[Stage]) {
+            trace->StageUs[Stage] += GetCurrentTimeUs() - Start;
+            trace->StageCount[Stage]++;
+        }
+    }
+};
+
+/*
+ * Finished traces are kept in bounded ring, the slowest ones are
+ * kept aside in bounded heap and survive rotation of the ring.
+ */
+class TTraceLog : public TLockable, public TNonCopyable {
+    std::deque<TRequestTrace> Ring;
+    std::vector<TRequestTrace> Slowest;
+
+public:
+    void Add(const TRequestTrace &trace);
+    void Dump(rpc::TTraceResponse &rsp, bool slowest);
+};
+
+extern TTraceLog TraceLog;
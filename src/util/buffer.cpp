@@ -0,0 +1,69 @@
+#include <cstring>
+
+#include "buffer.hpp"
+
+TBufferPool BufferPool;
+
+size_t TBufferPool::RoundUp(size_t size) {
+    size_t ret = MIN_SIZE;
+    while (ret < size && ret < MAX_SIZE)
+        ret <<= 1;
+    return ret < size ? size : ret;
+}
+
+static int SizeClass(size_t size) {
+    int shift = TBufferPool::MIN_SHIFT;
+    while ((1ul << shift) < size)
+        shift++;
+    return shift - TBufferPool::MIN_SHIFT;
+}
+
+uint8_t *TBufferPool::Get(size_t &size) {
+    size = RoundUp(size);
+    if (size <= MAX_SIZE) {
+        auto &free = Free[SizeClass(size)];
+        std::lock_guard<std::mutex> lock(Mutex);
+        if (!free.empty()) {
+            uint8_t *data = free.back();
+            free.pop_back();
+            return data;
+        }
+    }
+    return new uint8_t[size];
+}
+
+void TBufferPool::Put(uint8_t *data, size_t size) {
+    if (size <= MAX_SIZE) {
+        auto &free = Free[SizeClass(size)];
+        std::lock_guard<std::mutex> lock(Mutex);
+        if ((free.size() + 1) * size <= CLASS_BYTES) {
+            free.push_back(data);
+            return;
+        }
+    }
+    delete[] data;
+}
+
+TBufferPool::~TBufferPool() {
+    for (auto &free: Free)
+        for (auto data: free)
+            delete[] data;
+}
+
+void TPooledBuffer::Reserve(size_t size, size_t used) {
+    if (size <= Size)
+        return;
+    uint8_t *data = BufferPool.Get(size);
+    if (used)
+        memcpy(data, Data, used);
+    Release();
+    Data = data;
+    Size = size;
+}
+
+void TPooledBuffer::Release() {
+    if (Data)
+        BufferPool.Put(Data, Size);
+    Data = nullptr;
+    Size = 0;
+}
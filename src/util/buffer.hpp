@@ -0,0 +1,49 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+
+#include "common.hpp"
+
+/*
+ * I/O buffers in power of two size classes from 4KB to 1MB.
+ * Released buffers are kept for reuse up to some bytes per class,
+ * bigger buffers are allocated and freed directly.
+ */
+class TBufferPool : public TNonCopyable {
+public:
+    static constexpr int MIN_SHIFT = 12;
+    static constexpr int MAX_SHIFT = 20;
+    static constexpr size_t MIN_SIZE = 1ul << MIN_SHIFT;
+    static constexpr size_t MAX_SIZE = 1ul << MAX_SHIFT;
+    static constexpr size_t CLASS_BYTES = 4ul << 20;
+
+    static size_t RoundUp(size_t size);
+
+    /* size is rounded up to class */
+    uint8_t *Get(size_t &size);
+    void Put(uint8_t *data, size_t size);
+
+    ~TBufferPool();
+
+private:
+    std::mutex Mutex;
+    std::vector<uint8_t *> Free[MAX_SHIFT - MIN_SHIFT + 1];
+};
+
+extern TBufferPool BufferPool;
+
+class TPooledBuffer : public TNonCopyable {
+public:
+    uint8_t *Data = nullptr;
+    size_t Size = 0;
+
+    TPooledBuffer() {}
+    ~TPooledBuffer() {
+        Release();
+    }
+
+    /* Grow to at least size, keep first used bytes */
+    void Reserve(size_t size, size_t used = 0);
+    void Release();
+};
@@ -103,3 +103,7 @@ static uint32_t ssh_crc32(const char *buf, uint32_t size) {
 uint32_t Crc32(const std::string &s) {
     return ssh_crc32(s.c_str(), s.length());
 }
+
+uint32_t Crc32(const void *data, size_t len) {
+    return ssh_crc32((const char *)data, len);
+}
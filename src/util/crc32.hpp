@@ -3,3 +3,4 @@
 #include <string>
 
 uint32_t Crc32(const std::string &s);
+uint32_t Crc32(const void *data, size_t len);
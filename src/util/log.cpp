@@ -1,3 +1,12 @@
+#include <list>
+#include <queue>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+
 #include "statistics.hpp"
 #include "log.hpp"
 #include "util/unix.hpp"
@@ -18,7 +27,263 @@ TStatistics *Statistics = nullptr;
 
 TFile LogFile(STDOUT_FILENO);
 
+/* buffer is written when grows over this or once in flush period */
+#define LOG_BUFFER_FLUSH    (64 << 10)
+#define LOG_BUFFER_LIMIT    (4 << 20)
+#define LOG_FLUSH_MS        100
+#define LOG_RECORD_MAX      (64 << 20)
+
+struct TLogBuffer {
+    std::mutex Mutex;
+    std::string Data;
+    std::vector<std::pair<uint64_t, size_t>> Lines; /* time and end in Data */
+    bool Exited = false;
+
+    /* cached for this thread */
+    pid_t Tid;
+    time_t Time = 0;
+    std::string TimeStr;
+};
+
+/* marks buffer as exited when thread ends, writer drops it after flush */
+struct TLogBufferRef {
+    std::shared_ptr<TLogBuffer> Buffer;
+
+    ~TLogBufferRef() {
+        if (Buffer) {
+            std::lock_guard<std::mutex> lock(Buffer->Mutex);
+            Buffer->Exited = true;
+        }
+    }
+};
+
+static thread_local TLogBufferRef LogBufferRef;
+
+/* protects log file and list of buffers */
+static std::mutex LogMutex;
+static std::condition_variable LogCv;
+static std::list<std::shared_ptr<TLogBuffer>> LogBuffers;
+static std::thread LogWriter;
+static std::atomic<bool> LogAsync(false);
+static bool LogBinary = false;
+static bool LogStop = false;
+
+static const std::string LogPrefix[] = { "    ",
+                                         "WRN ",
+                                         "ERR ",
+                                         "EVT ",
+                                         "ACT ",
+                                         "REQ ",
+                                         "RSP ",
+                                         "SYS ",
+                                         "STK ", };
+
+static void AppendLogText(std::string &out, const std::string &time,
+                          const std::string &name, pid_t tid,
+                          ELogLevel level, const std::string &msg) {
+    out += time;
+    out += " ";
+    out += name;
+    out += "[";
+    out += std::to_string(tid);
+    out += "]: ";
+    out += LogPrefix[level];
+    out += msg;
+    if (msg.empty() || msg.back() != '\n')
+        out += "\n";
+}
+
+void AppendLogRecord(std::string &out, uint64_t timeUs,
+                     const std::string &name, pid_t tid,
+                     ELogLevel level, const std::string &msg) {
+    TLogRecord rec;
+    size_t nameLen = std::min(name.size(), (size_t)UINT8_MAX);
+
+    rec.Magic = PORTO_LOG_MAGIC;
+    rec.Size = nameLen + msg.size();
+    rec.TimeUs = timeUs;
+    rec.Tid = tid;
+    rec.Level = level;
+    rec.NameLen = nameLen;
+    rec.Reserved = 0;
+
+    out.append((const char *)&rec, sizeof(rec));
+    out.append(name, 0, nameLen);
+    out += msg;
+}
+
+/* wall clock, monotonic time is useless in log */
+static uint64_t LogTimeUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static TLogBuffer *GetLogBuffer() {
+    auto &buf = LogBufferRef.Buffer;
+
+    if (!buf) {
+        buf = std::make_shared<TLogBuffer>();
+        buf->Tid = GetTid();
+        std::lock_guard<std::mutex> lock(LogMutex);
+        LogBuffers.push_back(buf);
+    }
+
+    return buf.get();
+}
+
+struct TLogChunk {
+    std::string Data;
+    std::vector<std::pair<uint64_t, size_t>> Lines;
+    size_t Pos = 0;
+    size_t Line = 0;
+
+    uint64_t Time() const {
+        return Lines[Line].first;
+    }
+};
+
+/*
+ * Merges lines of all threads by time, stable for equal time.
+ * Runs of one thread between lines of others are copied at once.
+ */
+static void MergeLogChunks(std::vector<TLogChunk> &chunks, std::string &data) {
+    auto later = [&chunks](size_t a, size_t b) {
+        uint64_t ta = chunks[a].Time(), tb = chunks[b].Time();
+        return ta > tb || (ta == tb && a > b);
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(later)> heap(later);
+
+    for (size_t i = 0; i < chunks.size(); i++)
+        heap.push(i);
+
+    while (!heap.empty()) {
+        auto &chunk = chunks[heap.top()];
+        heap.pop();
+
+        size_t line = chunk.Line + 1;
+        if (!heap.empty()) {
+            uint64_t next = chunks[heap.top()].Time();
+            while (line < chunk.Lines.size() && chunk.Lines[line].first <= next)
+                line++;
+        } else
+            line = chunk.Lines.size();
+
+        size_t end = chunk.Lines[line - 1].second;
+        data.append(chunk.Data, chunk.Pos, end - chunk.Pos);
+        chunk.Pos = end;
+        chunk.Line = line;
+
+        if (line < chunk.Lines.size())
+            heap.push(&chunk - chunks.data());
+    }
+}
+
+/* under LogMutex, error path does not wait for locks held by crashed thread */
+static void FlushLogBuffers(bool wait) {
+    std::vector<TLogChunk> chunks;
+    std::string data;
+
+    for (auto it = LogBuffers.begin(); it != LogBuffers.end(); ) {
+        auto &buf = *it;
+        std::unique_lock<std::mutex> lock(buf->Mutex, std::defer_lock);
+
+        if (wait)
+            lock.lock();
+        else if (!lock.try_lock()) {
+            ++it;
+            continue;
+        }
+
+        if (!buf->Lines.empty()) {
+            chunks.emplace_back();
+            chunks.back().Data.swap(buf->Data);
+            chunks.back().Lines.swap(buf->Lines);
+        }
+
+        bool exited = buf->Exited;
+        lock.unlock();
+
+        if (exited)
+            it = LogBuffers.erase(it);
+        else
+            ++it;
+    }
+
+    if (chunks.size() == 1)
+        data.swap(chunks[0].Data);
+    else if (chunks.size() > 1)
+        MergeLogChunks(chunks, data);
+
+    if (!data.empty())
+        LogFile.WriteAll(data);
+}
+
+void FlushLog() {
+    if (!LogAsync)
+        return;
+    std::lock_guard<std::mutex> lock(LogMutex);
+    FlushLogBuffers(true);
+}
+
+static void LogWriterFn() {
+    SetProcessName("portod-log");
+
+    std::unique_lock<std::mutex> lock(LogMutex);
+    while (!LogStop) {
+        LogCv.wait_for(lock, std::chrono::milliseconds(LOG_FLUSH_MS));
+        FlushLogBuffers(true);
+    }
+}
+
+/* writer thread does not exist in forked child */
+static void LogForkChild() {
+    LogAsync = false;
+    LogBinary = false;
+}
+
+void StartLogWriter(bool binary) {
+    static bool atfork = false;
+
+    if (LogAsync)
+        return;
+
+    if (!atfork) {
+        pthread_atfork(nullptr, nullptr, LogForkChild);
+        atfork = true;
+    }
+
+    LogBinary = binary;
+    LogStop = false;
+
+    sigset_t saved;
+    BlockSignalFd(saved);
+    LogWriter = std::thread(LogWriterFn);
+    RestoreSignalMask(saved);
+
+    LogAsync = true;
+}
+
+void StopLogWriter() {
+    if (!LogAsync)
+        return;
+
+    std::unique_lock<std::mutex> lock(LogMutex);
+    LogAsync = false;
+    LogStop = true;
+    lock.unlock();
+
+    LogCv.notify_one();
+    LogWriter.join();
+
+    /* lines appended after last round of writer */
+    lock.lock();
+    FlushLogBuffers(true);
+    LogBinary = false;
+}
+
 void OpenLog(const TPath &path) {
+    std::lock_guard<std::mutex> lock(LogMutex);
     int fd;
 
     if (path.IsEmpty()) {
@@ -51,20 +316,47 @@ void WriteLog(std::string log_msg, ELogLevel level) {
             Statistics->Errors++;
     }
 
-    static const std::string prefix[] = { "    ",
-                                          "WRN ",
-                                          "ERR ",
-                                          "EVT ",
-                                          "ACT ",
-                                          "REQ ",
-                                          "RSP ",
-                                          "SYS ",
-                                          "STK ", };
-
-    std::string msg = FormatTime(time(nullptr)) + " " +
-        GetTaskName() + "[" + std::to_string(GetTid()) + "]: " +
-        prefix[level] + log_msg +
-        (log_msg.back() == '\n' ? "" : "\n");
+    if (LogAsync && level != LOG_ERROR && level != LOG_STACK) {
+        auto buf = GetLogBuffer();
+        uint64_t now = LogTimeUs();
+        std::unique_lock<std::mutex> lock(buf->Mutex);
+
+        if (LogBinary) {
+            AppendLogRecord(buf->Data, now, GetTaskName(), buf->Tid, level, log_msg);
+        } else {
+            time_t sec = now / 1000000;
+            if (sec != buf->Time) {
+                buf->Time = sec;
+                buf->TimeStr = FormatTime(sec);
+            }
+            AppendLogText(buf->Data, buf->TimeStr, GetTaskName(), buf->Tid, level, log_msg);
+        }
+        buf->Lines.emplace_back(now, buf->Data.size());
+
+        size_t size = buf->Data.size();
+        lock.unlock();
+
+        if (size >= LOG_BUFFER_LIMIT)
+            FlushLog();
+        else if (size >= LOG_BUFFER_FLUSH)
+            LogCv.notify_one();
+
+        return;
+    }
+
+    std::string msg;
+
+    if (LogAsync) {
+        /* keep order: errors go after pending lines */
+        std::unique_lock<std::mutex> lock(LogMutex, std::try_to_lock);
+        if (lock)
+            FlushLogBuffers(false);
+        if (LogBinary)
+            AppendLogRecord(msg, LogTimeUs(), GetTaskName(), GetTid(), level, log_msg);
+    }
+
+    if (msg.empty())
+        AppendLogText(msg, FormatTime(time(nullptr)), GetTaskName(), GetTid(), level, log_msg);
 
     LogFile.WriteAll(msg);
 
@@ -76,3 +368,55 @@ void porto_assert(const char *msg, const char *file, size_t line) {
     L_ERR("Assertion failed: {} at {}:{}", msg, file, line);
     Crash();
 }
+
+size_t DecodeLog(const char *data, size_t len, std::string &text, bool eof) {
+    const uint32_t magic = PORTO_LOG_MAGIC;
+    size_t pos = 0;
+
+    while (pos < len) {
+        size_t left = len - pos;
+
+        if (left >= sizeof(magic) && !memcmp(data + pos, &magic, sizeof(magic))) {
+            TLogRecord rec;
+
+            if (left < sizeof(rec)) {
+                if (!eof)
+                    break;
+                text.append(data + pos, left);
+                pos = len;
+                break;
+            }
+
+            memcpy(&rec, data + pos, sizeof(rec));
+            if (left < sizeof(rec) + rec.Size && rec.Size < LOG_RECORD_MAX && !eof)
+                break;
+
+            if (left >= sizeof(rec) + rec.Size && rec.NameLen <= rec.Size &&
+                    rec.Level <= LOG_STACK) {
+                const char *name = data + pos + sizeof(rec);
+                AppendLogText(text, FormatTime(rec.TimeUs / 1000000),
+                              std::string(name, rec.NameLen), rec.Tid,
+                              (ELogLevel)rec.Level,
+                              std::string(name + rec.NameLen, rec.Size - rec.NameLen));
+                pos += sizeof(rec) + rec.Size;
+                continue;
+            }
+        }
+
+        /* plain text, for example output of helpers, till next record */
+        const void *next = memmem(data + pos + 1, left - 1, &magic, sizeof(magic));
+        size_t end = next ? (const char *)next - data : len;
+
+        /* tail could be start of record */
+        if (!next && !eof) {
+            if (left < sizeof(magic))
+                break;
+            end = len - sizeof(magic) + 1;
+        }
+
+        text.append(data + pos, end - pos);
+        pos = end;
+    }
+
+    return pos;
+}
@@ -20,9 +20,38 @@ enum ELogLevel {
     LOG_STACK = 8,
 };
 
+#define PORTO_LOG_MAGIC 0x474f4c50 /* "PLOG" */
+
+/* binary log record, followed by task name and message */
+struct TLogRecord {
+    uint32_t Magic;
+    uint32_t Size;      /* task name plus message */
+    uint64_t TimeUs;
+    uint32_t Tid;
+    uint8_t Level;
+    uint8_t NameLen;
+    uint16_t Reserved;
+} __attribute__((packed));
+
 void OpenLog(const TPath &path);
 void WriteLog(std::string log_msg, ELogLevel level);
 
+/*
+ * Asynchronous logging: lines are appended into per-thread buffers
+ * and written by background thread merged by time. Errors are written
+ * at once after pending lines, forked children always write synchronously.
+ */
+void StartLogWriter(bool binary);
+void StopLogWriter();
+void FlushLog();
+
+void AppendLogRecord(std::string &out, uint64_t timeUs,
+                     const std::string &name, pid_t tid,
+                     ELogLevel level, const std::string &msg);
+
+/* converts binary records into text, other data is copied as is */
+size_t DecodeLog(const char *data, size_t len, std::string &text, bool eof);
+
 template <typename... Args> inline void L(const char* fmt, const Args&... args) {
     WriteLog(fmt::format(fmt, args...), LOG_NOTICE);
 }
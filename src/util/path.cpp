@@ -1210,6 +1210,31 @@ TError TFile::ReadAll(std::string &text, size_t max) const {
     return TError::Success();
 }
 
+/* Read from offset 0 without touching file position */
+TError TFile::PreadAll(std::string &text, size_t max) const {
+    size_t size = 4096, off = 0;
+    ssize_t ret;
+
+    text.resize(size);
+
+    do {
+        if (size - off < 1024) {
+            size += 16384;
+            if (size > max)
+                return TError(EError::Unknown, "File too large: " + std::to_string(size));
+            text.resize(size);
+        }
+        ret = pread(Fd, &text[off], size - off, off);
+        if (ret < 0)
+            return TError(EError::Unknown, errno, "pread");
+        off += ret;
+    } while (ret > 0);
+
+    text.resize(off);
+
+    return TError::Success();
+}
+
 TError TFile::WriteAll(const std::string &text) const {
     size_t len = text.length(), off = 0;
     do {
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+#include "common.hpp"
+
+/*
+ * Bounded multi-producer multi-consumer lock-free queue.
+ * Dmitry Vyukov's array based algorithm: each cell carries sequence
+ * number which tells whether it is ready for push or for pop.
+ */
+template<typename T>
+class TMpmcQueue : public TNonCopyable {
+    struct TCell {
+        std::atomic<size_t> Seq;
+        T Data;
+    };
+
+    static constexpr size_t CACHE_LINE = 64;
+
+    std::unique_ptr<TCell[]> Cells;
+    const size_t Mask;
+
+    char Pad0[CACHE_LINE];
+    std::atomic<size_t> PushPos;
+    char Pad1[CACHE_LINE];
+    std::atomic<size_t> PopPos;
+    char Pad2[CACHE_LINE];
+
+    static size_t RoundUp(size_t size) {
+        size_t ret = 2;
+        while (ret < size)
+            ret <<= 1;
+        return ret;
+    }
+
+public:
+    TMpmcQueue(size_t size) : Cells(new TCell[RoundUp(size)]), Mask(RoundUp(size) - 1) {
+        for (size_t i = 0; i <= Mask; i++)
+            Cells[i].Seq.store(i, std::memory_order_relaxed);
+        PushPos.store(0, std::memory_order_relaxed);
+        PopPos.store(0, std::memory_order_relaxed);
+    }
+
+    size_t Capacity() const {
+        return Mask + 1;
+    }
+
+    /* Approximate, exact only when nobody touches queue */
+    size_t Size() const {
+        size_t push = PushPos.load(std::memory_order_relaxed);
+        size_t pop = PopPos.load(std::memory_order_relaxed);
+        return push > pop ? push - pop : 0;
+    }
+
+    bool Empty() const {
+        return !Size();
+    }
+
+    /* Returns false if queue is full */
+    bool Push(const T &elem) {
+        size_t pos = PushPos.load(std::memory_order_relaxed);
+        TCell *cell;
+
+        while (1) {
+            cell = &Cells[pos & Mask];
+            size_t seq = cell->Seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (!diff) {
+                if (PushPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                return false;
+            } else
+                pos = PushPos.load(std::memory_order_relaxed);
+        }
+
+        cell->Data = elem;
+        cell->Seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /* Returns false if queue is empty */
+    bool Pop(T &elem) {
+        size_t pos = PopPos.load(std::memory_order_relaxed);
+        TCell *cell;
+
+        while (1) {
+            cell = &Cells[pos & Mask];
+            size_t seq = cell->Seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (!diff) {
+                if (PopPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                return false;
+            } else
+                pos = PopPos.load(std::memory_order_relaxed);
+        }
+
+        elem = std::move(cell->Data);
+        cell->Data = T(); /* drop references held by the cell */
+        cell->Seq.store(pos + Mask + 1, std::memory_order_release);
+        return true;
+    }
+};
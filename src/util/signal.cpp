@@ -145,9 +145,7 @@ void Signal(int signum, void (*handler)(int)) {
     }
 }
 
-int SignalFd() {
-    sigset_t sigMask;
-
+static void SignalFdMask(sigset_t &sigMask) {
     sigemptyset(&sigMask);
     sigaddset(&sigMask, SIGHUP);
     sigaddset(&sigMask, SIGINT);
@@ -155,6 +153,27 @@ int SignalFd() {
     sigaddset(&sigMask, SIGUSR1);
     sigaddset(&sigMask, SIGUSR2);
     sigaddset(&sigMask, SIGCHLD);
+}
+
+/*
+ * Threads inherit signal mask. Threads started before SignalFd()
+ * must have these signals blocked, otherwise they steal them.
+ */
+void BlockSignalFd(sigset_t &saved) {
+    sigset_t sigMask;
+
+    SignalFdMask(sigMask);
+    pthread_sigmask(SIG_BLOCK, &sigMask, &saved);
+}
+
+void RestoreSignalMask(const sigset_t &saved) {
+    pthread_sigmask(SIG_SETMASK, &saved, nullptr);
+}
+
+int SignalFd() {
+    sigset_t sigMask;
+
+    SignalFdMask(sigMask);
 
     if (sigprocmask(SIG_BLOCK, &sigMask, NULL)) {
         L_ERR("Cannot block signals");
@@ -14,4 +14,6 @@ void ResetBlockedSignals();
 void ResetIgnoredSignals();
 
 void Signal(int signum, void (*handler)(int));
+void BlockSignalFd(sigset_t &saved);
+void RestoreSignalMask(const sigset_t &saved);
 int SignalFd();
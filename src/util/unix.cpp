@@ -162,6 +162,19 @@ uint64_t GetCurrentTimeMs() {
     return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
+uint64_t GetCurrentTimeUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* ms since epoch, for timestamps shown to users */
+uint64_t GetWallTimeMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 bool WaitDeadline(uint64_t deadline, uint64_t wait) {
     uint64_t now = GetCurrentTimeMs();
     if (!deadline || int64_t(deadline - now) < 0)
@@ -39,6 +39,8 @@ pid_t GetTid();
 TError GetTaskChildrens(pid_t pid, std::vector<pid_t> &childrens);
 
 uint64_t GetCurrentTimeMs();
+uint64_t GetCurrentTimeUs();
+uint64_t GetWallTimeMs();
 bool WaitDeadline(uint64_t deadline, uint64_t sleep = 10);
 uint64_t GetTotalMemory();
 uint64_t GetTotalThreads();
@@ -3,10 +3,13 @@
 #include <condition_variable>
 #include <thread>
 #include <queue>
+#include <atomic>
+#include <algorithm>
 
 #include "util/log.hpp"
 #include "util/unix.hpp"
 #include "util/locks.hpp"
+#include "util/queue.hpp"
 
 template<typename T,
          typename Q = std::queue<T>>
@@ -97,3 +100,231 @@ public:
     virtual const T &Top() =0;
     virtual bool Handle(const T &elem) =0;
 };
+
+/*
+ * Worker pool on top of lock-free queues. Push and pop do not touch
+ * mutex while workers are busy, mutex and condvar are used only for
+ * putting idle workers to sleep and waking them up.
+ * Element is popped atomically, thus it's passed directly into Handle.
+ *
+ * Elements are split into classes by Classify(), class index is priority:
+ * idle worker always checks class 0 first. Limit of class bounds count of
+ * workers running this class and all classes after it, this way lower
+ * classes cannot occupy workers reserved for higher ones.
+ *
+ * Fair share bounds count of running elements with the same FairKey()
+ * in one class, elements over share are rotated back into queue while
+ * others are waiting. Keys are hashed into buckets, collision only makes
+ * share stricter.
+ */
+template<typename T>
+class TMpmcWorker : public TLockable {
+protected:
+    static constexpr size_t FAIR_BUCKETS = 256;
+
+    struct TClass {
+        TMpmcQueue<T> Queue;
+        size_t Limit;
+        size_t FairShare = 0;
+        std::atomic<size_t> Running; /* this and all lower classes */
+        std::atomic<size_t> Fair[FAIR_BUCKETS];
+
+        TClass(size_t size, size_t limit) : Queue(size), Limit(limit), Running(0) {
+            for (auto &fair: Fair)
+                fair.store(0, std::memory_order_relaxed);
+        }
+    };
+
+    std::atomic<bool> Valid;
+    std::vector<std::unique_ptr<TClass>> Classes;
+    std::condition_variable Cv;
+    std::atomic<size_t> Sleeping;
+    std::vector<std::shared_ptr<std::thread>> Threads;
+    const std::string Name;
+    const size_t Nr;
+
+    bool Acquire(int cls) {
+        for (int i = 0; i <= cls; i++) {
+            auto &running = Classes[i]->Running;
+            size_t cur = running.load(std::memory_order_relaxed);
+            do {
+                if (cur >= Classes[i]->Limit) {
+                    while (i--)
+                        Classes[i]->Running--;
+                    return false;
+                }
+            } while (!running.compare_exchange_weak(cur, cur + 1));
+        }
+        return true;
+    }
+
+    void Release(int cls) {
+        for (int i = 0; i <= cls; i++)
+            Classes[i]->Running--;
+    }
+
+    bool PopClass(int cls, T &elem, size_t &bucket) {
+        auto &c = *Classes[cls];
+
+        if (c.Queue.Empty() || !Acquire(cls))
+            return false;
+
+        for (size_t tries = c.Queue.Size(); tries && c.Queue.Pop(elem); tries--) {
+            if (!c.FairShare) {
+                bucket = 0;
+                return true;
+            }
+
+            bucket = FairKey(elem) % FAIR_BUCKETS;
+            if (++c.Fair[bucket] <= c.FairShare || c.Queue.Empty() ||
+                    !c.Queue.Push(elem))
+                return true;
+
+            c.Fair[bucket]--;
+        }
+
+        Release(cls);
+        return false;
+    }
+
+    bool Pop(T &elem, int &cls, size_t &bucket) {
+        for (cls = 0; cls < (int)Classes.size(); cls++)
+            if (PopClass(cls, elem, bucket))
+                return true;
+        return false;
+    }
+
+public:
+    TMpmcWorker(const std::string &name, size_t nr, size_t size, int classes = 1) :
+            Valid(true), Sleeping(0), Name(name), Nr(nr) {
+        for (int i = 0; i < classes; i++)
+            Classes.emplace_back(new TClass(size, nr));
+    }
+
+    /* Must be called before Start() */
+    void SetClassLimit(int cls, size_t limit, size_t fairShare = 0) {
+        Classes[cls]->Limit = std::max(limit, (size_t)1);
+        Classes[cls]->FairShare = fairShare;
+    }
+
+    void Start() {
+        for (size_t i = 0; i < Nr; i++)
+            Threads.push_back(std::make_shared<std::thread>(&TMpmcWorker::WorkerFn, this, Name + std::to_string(i)));
+    }
+
+    void Stop() {
+        if (Valid) {
+            {
+                auto lock = ScopedLock();
+                Valid = false;
+                Cv.notify_all();
+            }
+            for (auto thread : Threads)
+                thread->join();
+            Threads.clear();
+        }
+    }
+
+    /* Returns false if queue is full, caller holds element back */
+    bool Push(const T &elem) {
+        auto &queue = Classes[Classify(elem)]->Queue;
+
+        if (!queue.Push(elem))
+            return false;
+
+        /* pairs with fence in Sleep() */
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (Sleeping.load(std::memory_order_relaxed)) {
+            auto lock = ScopedLock();
+            Cv.notify_one();
+        }
+
+        return true;
+    }
+
+    size_t Size() const {
+        size_t size = 0;
+        for (auto &c: Classes)
+            size += c->Queue.Size();
+        return size;
+    }
+
+    size_t Size(int cls) const {
+        return Classes[cls]->Queue.Size();
+    }
+
+    /*
+     * Elements held back by class limit or fair share are picked up
+     * by worker which releases them, so sleeper does not miss them.
+     */
+    bool Sleep(T &elem, int &cls, size_t &bucket) {
+        /* short spin before sleep, wakeup is more expensive than yield */
+        for (int i = 0; i < 16; i++) {
+            std::this_thread::yield();
+            if (Pop(elem, cls, bucket))
+                return true;
+        }
+
+        auto lock = ScopedLock();
+
+        Sleeping++;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        while (Valid && !Pop(elem, cls, bucket))
+            Cv.wait(lock);
+
+        Sleeping--;
+
+        return Valid;
+    }
+
+    void WorkerFn(const std::string &name) {
+        try {
+            SetProcessName(name);
+            T request;
+            int cls;
+            size_t bucket;
+
+            while (Valid) {
+                if (!Pop(request, cls, bucket) && !Sleep(request, cls, bucket))
+                    break;
+
+                bool done = Handle(request);
+
+                if (Classes[cls]->FairShare)
+                    Classes[cls]->Fair[bucket]--;
+                Release(cls);
+
+                /* released slot could unblock element held back for sleeper */
+                if (Sleeping.load(std::memory_order_relaxed) && Size()) {
+                    auto lock = ScopedLock();
+                    Cv.notify_one();
+                }
+
+                if (!done) {
+                    Push(request);
+                    std::this_thread::yield();
+                }
+
+                request = T();
+            }
+        } catch (std::string s) {
+            L_ERR("EXCEPTION: {}", s);
+            Crash();
+        } catch (const char *s) {
+            L_ERR("EXCEPTION: {}", s);
+            Crash();
+        } catch (const std::exception &exc) {
+            L_ERR("EXCEPTION: {}", exc.what());
+            Crash();
+        } catch (...) {
+            L_ERR("EXCEPTION: uncaught exception!");
+            Crash();
+        }
+    }
+
+    virtual int Classify(const T &) { return 0; }
+    virtual size_t FairKey(const T &) { return 0; }
+    virtual bool Handle(const T &elem) =0;
+};
@@ -14,6 +14,7 @@
 #include "helpers.hpp"
 #include "client.hpp"
 #include "filesystem.hpp"
+#include "notify.hpp"
 
 extern "C" {
 #include <unistd.h>
@@ -1917,13 +1918,15 @@ TError TVolume::DestroyOne(bool strict) {
         }
     }
 
-    TPath node(VolumesKV / Id);
-    error = node.Unlink();
+    TKeyValue node(VolumesKV / Id);
+    error = node.Remove();
     if (!ret && error)
         ret = error;
 
     lock.unlock();
 
+    NotifyLog.Publish(ENotifyObject::Volume, "volume_destroy", Path.ToString());
+
     return ret;
 }
 
@@ -2145,7 +2148,10 @@ TError TVolume::Save() {
     if (CustomPlace)
         node.Set(V_PLACE, Place.ToString());
 
-    return node.Save();
+    if (!SavedNode)
+        SavedNode = std::make_shared<TKeyValue>(node.Path);
+
+    return node.Update(*SavedNode);
 }
 
 TError TVolume::Restore(const TKeyValue &node) {
@@ -2301,6 +2307,8 @@ TError TVolume::Create(const TStringMap &cfg, std::shared_ptr<TVolume> &volume)
         return error;
     }
 
+    NotifyLog.Publish(ENotifyObject::Volume, "volume_create", volume->Path.ToString());
+
     VolumesCv.notify_all();
 
     return TError::Success();
@@ -2323,7 +2331,7 @@ void TVolume::RestoreAll(void) {
         error = node.Load();
         if (error) {
             L_WRN("Cannot load {} removed: {}", node.Path, error);
-            node.Path.Unlink();
+            node.Remove();
             continue;
         }
 
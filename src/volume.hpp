@@ -105,6 +105,9 @@ public:
 
     std::set<std::shared_ptr<TVolume>> Nested;
 
+    /* last saved state, storage gets only changes */
+    std::shared_ptr<TKeyValue> SavedNode;
+
     TVolume() {
         Statistics->VolumesCount++;
     }
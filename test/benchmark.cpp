@@ -0,0 +1,314 @@
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <functional>
+#include <chrono>
+
+extern "C" {
+#include <unistd.h>
+#include <signal.h>
+}
+
+#include "test.hpp"
+#include "util/worker.hpp"
+#include "util/string.hpp"
+
+namespace test {
+
+static uint64_t NowUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void Report(const std::string &name, uint64_t ops, uint64_t us) {
+    std::cout << name << ": " << ops << " ops in " << us / 1000 << " ms, "
+              << (us ? ops * 1000000 / us : 0) << " ops/s" << std::endl;
+}
+
+struct TBenchItem {
+    std::shared_ptr<std::atomic<uint64_t>> Counter;
+};
+
+class TBenchLockedWorker : public TWorker<TBenchItem> {
+public:
+    TBenchLockedWorker(size_t nr) : TWorker("bench-locked", nr) {}
+
+    const TBenchItem &Top() override {
+        return Queue.front();
+    }
+
+    bool Handle(const TBenchItem &item) override {
+        (*item.Counter)++;
+        return true;
+    }
+};
+
+class TBenchMpmcWorker : public TMpmcWorker<TBenchItem> {
+public:
+    TBenchMpmcWorker(size_t nr, size_t size) : TMpmcWorker("bench-mpmc", nr, size) {}
+
+    /* producers wait for workers if queue is full */
+    void Push(const TBenchItem &item) {
+        while (!TMpmcWorker::Push(item))
+            std::this_thread::yield();
+    }
+
+    bool Handle(const TBenchItem &item) override {
+        (*item.Counter)++;
+        return true;
+    }
+};
+
+template<typename W>
+static uint64_t RunQueue(W &worker, int producers, uint64_t items) {
+    auto counter = std::make_shared<std::atomic<uint64_t>>(0);
+    std::vector<std::thread> threads;
+
+    worker.Start();
+
+    uint64_t start = NowUs();
+
+    for (int p = 0; p < producers; p++)
+        threads.emplace_back([&worker, counter, items, producers] {
+            TBenchItem item;
+            item.Counter = counter;
+            for (uint64_t i = 0; i < items / producers; i++)
+                worker.Push(item);
+        });
+
+    for (auto &thread: threads)
+        thread.join();
+
+    uint64_t total = items / producers * producers;
+    while (*counter < total)
+        std::this_thread::yield();
+
+    uint64_t us = NowUs() - start;
+
+    worker.Stop();
+
+    return us;
+}
+
+/* compare mutex-protected queue and lock-free queue under TWorker */
+static void BenchWorkerQueue(const std::vector<std::string> &args) {
+    int producers = 4, consumers = 16;
+    uint64_t items = 1000000;
+
+    if (args.size() >= 1)
+        StringToInt(args[0], producers);
+    if (args.size() >= 2)
+        StringToInt(args[1], consumers);
+    if (args.size() >= 3)
+        StringToUint64(args[2], items);
+
+    std::cout << "Producers: " << producers << " Consumers: " << consumers
+              << " Items: " << items << std::endl;
+
+    {
+        TBenchLockedWorker worker(consumers);
+        Report("mutex queue", items, RunQueue(worker, producers, items));
+    }
+
+    {
+        TBenchMpmcWorker worker(consumers, 1024);
+        Report("mpmc queue", items, RunQueue(worker, producers, items));
+    }
+}
+
+struct TBenchClassItem {
+    bool Heavy;
+    uint64_t Client;
+    uint64_t Queued;
+    std::shared_ptr<std::atomic<uint64_t>> Latency;
+    std::shared_ptr<std::atomic<uint64_t>> Counter;
+};
+
+class TBenchClassWorker : public TMpmcWorker<TBenchClassItem> {
+public:
+    TBenchClassWorker(size_t nr, int classes) :
+        TMpmcWorker("bench-class", nr, 4096, classes) {}
+
+    void Push(const TBenchClassItem &item) {
+        while (!TMpmcWorker::Push(item))
+            std::this_thread::yield();
+    }
+
+    int Classify(const TBenchClassItem &item) override {
+        return item.Heavy ? Classes.size() - 1 : 0;
+    }
+
+    size_t FairKey(const TBenchClassItem &item) override {
+        return item.Client;
+    }
+
+    bool Handle(const TBenchClassItem &item) override {
+        *item.Latency += NowUs() - item.Queued;
+        (*item.Counter)++;
+        /* heavy items emulate volume and layer operations */
+        if (item.Heavy)
+            usleep(10000);
+        else
+            usleep(100);
+        return true;
+    }
+};
+
+/* read latency while burst of heavy requests occupies workers */
+static void BenchWorkerClasses(const std::vector<std::string> &args) {
+    int workers = 8, heavy = 64, reads = 200;
+
+    if (args.size() >= 1)
+        StringToInt(args[0], workers);
+    if (args.size() >= 2)
+        StringToInt(args[1], heavy);
+    if (args.size() >= 3)
+        StringToInt(args[2], reads);
+
+    std::cout << "Workers: " << workers << " Heavy: " << heavy
+              << " Reads: " << reads << std::endl;
+
+    for (int classes = 1; classes <= 2; classes++) {
+        TBenchClassWorker worker(workers, classes);
+        auto latency = std::make_shared<std::atomic<uint64_t>>(0);
+        auto counter = std::make_shared<std::atomic<uint64_t>>(0);
+        auto ignore = std::make_shared<std::atomic<uint64_t>>(0);
+
+        if (classes > 1) {
+            worker.SetClassLimit(0, workers, workers / 2);
+            worker.SetClassLimit(1, workers / 2, workers / 2);
+        }
+
+        worker.Start();
+
+        for (int i = 0; i < heavy; i++)
+            worker.Push({true, 1, NowUs(), ignore, ignore});
+
+        for (int i = 0; i < reads; i++) {
+            worker.Push({false, (uint64_t)i + 2, NowUs(), latency, counter});
+            usleep(1000);
+        }
+
+        while (*counter < (uint64_t)reads)
+            std::this_thread::yield();
+
+        worker.Stop();
+
+        std::cout << (classes > 1 ? "classes" : "single queue")
+                  << ": average read latency " << *latency / reads << " us" << std::endl;
+    }
+}
+
+/* short connections and requests from the same client, needs running portod */
+static void BenchConnect(const std::vector<std::string> &args) {
+    int connections = 1000, requests = 10;
+
+    if (args.size() >= 1)
+        StringToInt(args[0], connections);
+    if (args.size() >= 2)
+        StringToInt(args[1], requests);
+
+    std::cout << "Connections: " << connections << " Requests: " << requests << std::endl;
+
+    std::string tag, revision;
+    uint64_t start = NowUs();
+
+    for (int i = 0; i < connections; i++) {
+        Porto::Connection api;
+        for (int r = 0; r < requests; r++) {
+            if (api.GetVersion(tag, revision)) {
+                std::cerr << "Cannot get version" << std::endl;
+                return;
+            }
+        }
+        api.Close();
+    }
+
+    Report("connect", connections, NowUs() - start);
+}
+
+/* portod reload with tree of meta containers, needs running portod */
+static void BenchRestore(const std::vector<std::string> &args) {
+    std::vector<int> counts = {1000, 5000, 10000};
+    int fanout = 100;
+
+    if (args.size() >= 1) {
+        counts.clear();
+        for (auto &arg: args) {
+            int count;
+            if (!StringToInt(arg, count) && count > 0)
+                counts.push_back(count);
+        }
+    }
+
+    Porto::Connection api;
+    std::vector<std::string> list;
+
+    for (int count: counts) {
+        int parents = std::max(count / fanout, 1);
+
+        std::cout << "Containers: " << count << " Parents: " << parents << std::endl;
+
+        for (int i = 0; i < count; i++) {
+            std::string name = "bench-restore-" + std::to_string(i % parents);
+            if (i >= parents)
+                name += "/" + std::to_string(i);
+            if (api.Create(name) || api.Start(name)) {
+                std::cerr << "Cannot start " << name << std::endl;
+                return;
+            }
+        }
+
+        int pid = ReadPid(PORTO_PIDFILE);
+        uint64_t start = NowUs();
+
+        if (kill(ReadPid(PORTO_MASTER_PIDFILE), SIGHUP)) {
+            std::cerr << "Cannot reload portod" << std::endl;
+            return;
+        }
+
+        /* pidfile is rewritten by new portod before it accepts requests */
+        int newPid = pid;
+        api.Close();
+        while (newPid == pid || api.List(list)) {
+            usleep(1000);
+            if (TPath(PORTO_PIDFILE).ReadInt(newPid))
+                newPid = pid;
+        }
+
+        Report("restore " + std::to_string(count), count, NowUs() - start);
+
+        for (int i = 0; i < parents; i++)
+            api.Destroy("bench-restore-" + std::to_string(i));
+    }
+}
+
+int Benchmark(std::vector<std::string> args) {
+    std::pair<std::string, std::function<void(const std::vector<std::string> &)>> benchmarks[] = {
+        { "queue", BenchWorkerQueue },
+        { "classes", BenchWorkerClasses },
+        { "connect", BenchConnect },
+        { "restore", BenchRestore },
+    };
+
+    if (args.empty()) {
+        for (auto &bench: benchmarks)
+            std::cout << bench.first << std::endl;
+        return EXIT_SUCCESS;
+    }
+
+    for (auto &bench: benchmarks) {
+        if (bench.first != args[0])
+            continue;
+
+        Say() << "Benchmark " << bench.first << std::endl;
+        bench.second(std::vector<std::string>(args.begin() + 1, args.end()));
+        return EXIT_SUCCESS;
+    }
+
+    std::cerr << "Unknown benchmark " << args[0] << std::endl;
+    return EXIT_FAILURE;
+}
+
+}
@@ -38,9 +38,23 @@ static int Stresstest(int argc, char *argv[]) {
     return test::StressTest(threads, iter, killPorto);
 }
 
+static int StressLocks(int argc, char *argv[]) {
+    int threads = 16, depth = 8, iter = 1000;
+    if (argc >= 1)
+        StringToInt(argv[0], threads);
+    if (argc >= 2)
+        StringToInt(argv[1], depth);
+    if (argc >= 3)
+        StringToInt(argv[2], iter);
+    std::cout << "Threads: " << threads << " Depth: " << depth << " Iterations: " << iter << std::endl;
+    return test::StressLocks(threads, depth, iter);
+}
+
 static void Usage() {
     std::cout << "usage: " << program_invocation_short_name << " [--except] <selftest>..." << std::endl;
     std::cout << "       " << program_invocation_short_name << " stress [threads] [iterations] [kill=on/off]" << std::endl;
+    std::cout << "       " << program_invocation_short_name << " stress-locks [threads] [depth] [iterations]" << std::endl;
+    std::cout << "       " << program_invocation_short_name << " bench [benchmark] [args]..." << std::endl;
 }
 
 static int TestConnectivity() {
@@ -69,6 +83,9 @@ int main(int argc, char *argv[])
         }
     }
 
+    if (argc >= 2 && !strcmp(argv[1], "bench"))
+        return test::Benchmark(std::vector<std::string>(argv + 2, argv + argc));
+
     // in case client closes pipe we are writing to in the protobuf code
     Signal(SIGPIPE, SIG_IGN);
 
@@ -109,6 +126,8 @@ int main(int argc, char *argv[])
 
         if (what == "stress")
             return Stresstest(argc - 2, argv + 2);
+        else if (what == "stress-locks")
+            return StressLocks(argc - 2, argv + 2);
         else
             return Selftest(argc - 1, argv + 1);
     } catch (string err) {
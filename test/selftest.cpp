@@ -13,6 +13,9 @@
 #include "util/unix.hpp"
 #include "util/cred.hpp"
 #include "util/idmap.hpp"
+#include "util/queue.hpp"
+#include "util/log.hpp"
+#include "kvalue.hpp"
 #include "protobuf.hpp"
 #include "test.hpp"
 #include "rpc.hpp"
@@ -2831,6 +2834,32 @@ static void TestIdmap(Porto::Connection &) {
     ExpectEq(id, 2);
 }
 
+static void TestMpmcQueue(Porto::Connection &) {
+    TMpmcQueue<int> queue(3);
+    int val = 0;
+
+    ExpectEq(queue.Capacity(), 4);
+    Expect(queue.Empty());
+    Expect(!queue.Pop(val));
+
+    for (int i = 0; i < 4; i++)
+        Expect(queue.Push(i));
+
+    Expect(!queue.Push(4));
+    ExpectEq(queue.Size(), 4);
+
+    for (int i = 0; i < 4; i++) {
+        Expect(queue.Pop(val));
+        ExpectEq(val, i);
+    }
+
+    Expect(!queue.Pop(val));
+    Expect(queue.Push(5));
+    Expect(queue.Pop(val));
+    ExpectEq(val, 5);
+    Expect(queue.Empty());
+}
+
 static void TestFormat(Porto::Connection &) {
     uint64_t v;
 
@@ -2854,6 +2883,276 @@ static void TestFormat(Porto::Connection &) {
     Expect(!!StringToSize("1z", v));
 }
 
+static void TestLogDecode(Porto::Connection &) {
+    std::string time = FormatTime(1500000000);
+    std::string data, text;
+
+    AppendLogRecord(data, 1500000000000000ull, "portod", 42, LOG_WARN, "first");
+    AppendLogRecord(data, 1500000000000000ull, "portod-io0", 43, LOG_NOTICE, "second\n");
+    std::string line1 = time + " portod[42]: WRN first\n";
+    std::string line2 = time + " portod-io0[43]:     second\n";
+    size_t rec1 = sizeof(TLogRecord) + 6 + 5;
+
+    /* record followed by plain text */
+    ExpectEq(DecodeLog(data.c_str(), rec1, text, true), rec1);
+    ExpectEq(text, line1);
+    text.clear();
+    std::string mixed = data.substr(0, rec1) + "helper output\n" + data.substr(rec1);
+    ExpectEq(DecodeLog(mixed.c_str(), mixed.size(), text, true), mixed.size());
+    ExpectEq(text, line1 + "helper output\n" + line2);
+
+    /* record split across chunks waits for the rest */
+    for (size_t split: { rec1 + 2, rec1 + sizeof(TLogRecord) + 3, data.size() - 1 }) {
+        std::string buf = data.substr(0, split);
+        text.clear();
+        size_t pos = DecodeLog(buf.c_str(), buf.size(), text, false);
+        ExpectEq(pos, rec1);
+        ExpectEq(text, line1);
+        buf.erase(0, pos);
+        buf += data.substr(split);
+        ExpectEq(DecodeLog(buf.c_str(), buf.size(), text, false), buf.size());
+        ExpectEq(text, line1 + line2);
+    }
+
+    /* plain text tail could be start of record, it waits for magic */
+    std::string plain = "helper" + data.substr(0, 2);
+    text.clear();
+    ExpectEq(DecodeLog(plain.c_str(), plain.size(), text, false), 5);
+    ExpectEq(text, "helpe");
+    ExpectEq(DecodeLog(plain.c_str() + 5, 3, text, true), 3);
+    ExpectEq(text, plain);
+
+    /* truncated tail at eof is copied as is */
+    for (size_t cut: { (size_t)2, sizeof(TLogRecord) - 1, sizeof(TLogRecord) + 3 }) {
+        std::string buf = data.substr(0, rec1 + cut);
+        text.clear();
+        ExpectEq(DecodeLog(buf.c_str(), buf.size(), text, true), buf.size());
+        ExpectEq(text, line1 + data.substr(rec1, cut));
+    }
+}
+
+static void ExpectKvNode(const TPath &path, const std::string &val) {
+    TKeyValue node(path);
+    ExpectSuccess(node.Load());
+    ExpectEq(node.Get("key"), val);
+}
+
+static void TestKvDelta(Porto::Connection &api) {
+    TPath root(TMPDIR + "/kvdelta");
+    TPath path = root / "a";
+    std::string buf;
+
+    AsRoot(api);
+
+    (void)root.RemoveAll();
+    ExpectSuccess(root.MkdirAll(0755));
+
+    TKeyValue node(path), saved(path);
+    node.Set("a", "1");
+    node.Set("b", "2");
+    node.Set("c", "3");
+    ExpectSuccess(node.Update(saved));
+    ExpectEq(node.Size, node.BaseSize);
+
+    /* deletion rewrites node, changes are appended */
+    node.Set("b", "22");
+    node.Del("c");
+    ExpectSuccess(node.Update(saved));
+    ExpectEq(node.Size, node.BaseSize);
+    node.Set("d", "4");
+    ExpectSuccess(node.Update(saved));
+    Expect(node.Size > node.BaseSize);
+
+    /* nothing changed, nothing written */
+    uint64_t size = node.Size;
+    ExpectSuccess(node.Update(saved));
+    ExpectEq(saved.Size, size);
+
+    ExpectSuccess(path.ReadAll(buf));
+    ExpectEq(buf.size(), size);
+
+    TKeyValue loaded(path);
+    ExpectSuccess(loaded.Load());
+    Expect(loaded.Data == node.Data);
+    Expect(!loaded.Has("c"));
+    ExpectEq(loaded.BaseSize, node.BaseSize);
+    ExpectEq(loaded.Size, size);
+
+    /* torn tail is ignored and forces rewrite at next update */
+    ExpectSuccess(path.WriteAll(buf + std::string("\x64" "abc", 4)));
+
+    TKeyValue torn(path);
+    ExpectSuccess(torn.Load());
+    Expect(torn.Data == node.Data);
+    ExpectEq(torn.Size, 0);
+
+    TKeyValue next(path);
+    next.Data = torn.Data;
+    next.Set("e", "5");
+    ExpectSuccess(next.Update(torn));
+    ExpectEq(next.Size, next.BaseSize);
+
+    TKeyValue rewritten(path);
+    ExpectSuccess(rewritten.Load());
+    Expect(rewritten.Data == next.Data);
+
+    /* deltas are folded when they outgrow full node */
+    for (int i = 0; i < 100; i++) {
+        next.Set("big", std::string(100, 'a' + i % 26));
+        ExpectSuccess(next.Update(torn));
+        ExpectLess(next.Size - next.BaseSize,
+                   std::max(next.BaseSize, (uint64_t)getpagesize()) + 1);
+    }
+
+    TKeyValue folded(path);
+    ExpectSuccess(folded.Load());
+    Expect(folded.Data == next.Data);
+
+    /* first record cannot be torn */
+    ExpectSuccess(path.WriteAll(std::string("\x64" "abc", 4)));
+    Expect(!!folded.Load());
+
+    /* typed and text values replace each other */
+    TKeyValue typed(root / "b"), typedSaved(root / "b");
+    typed.Set("a", "text");
+    typed.SetTyped("b", "\x08\x01");
+    ExpectSuccess(typed.Update(typedSaved));
+    typed.SetTyped("a", "\x08\x02");
+    typed.Set("b", "text");
+    ExpectSuccess(typed.Update(typedSaved));
+    typed.Del("a");
+    typed.SetTyped("c", "\x08\x03");
+    ExpectSuccess(typed.Update(typedSaved));
+
+    TKeyValue typedLoaded(root / "b");
+    ExpectSuccess(typedLoaded.Load());
+    Expect(!typedLoaded.Has("a"));
+    ExpectEq(typedLoaded.Get("b"), "text");
+    Expect(!typedLoaded.Typed.count("b"));
+    ExpectEq(typedLoaded.Typed["c"], "\x08\x03");
+
+    ExpectSuccess(root.RemoveAll());
+}
+
+static void TestKvStore(Porto::Connection &api) {
+    TPath root(TMPDIR + "/kvstore");
+    auto saved = config();
+    TError error;
+
+    AsRoot(api);
+
+    /* small slots to keep store file small */
+    config().set_keyvalue_limit(64 << 10);
+    config().set_keyvalue_store_slot(68 << 10);
+    config().set_keyvalue_store(true);
+
+    (void)root.UmountAll();
+    (void)root.RemoveAll();
+    ExpectSuccess(TKeyValue::Mount(root));
+    Expect((root / ".store").Exists());
+
+    /* write, read, overwrite, remove */
+    TKeyValue node(root / "a");
+    node.Set("key", "1");
+    ExpectSuccess(node.Save());
+    ExpectKvNode(root / "a", "1");
+    node.Set("key", "2");
+    ExpectSuccess(node.Save());
+    ExpectKvNode(root / "a", "2");
+
+    std::list<TKeyValue> nodes;
+    ExpectSuccess(TKeyValue::ListAll(root, nodes));
+    ExpectEq(nodes.size(), 1);
+    Expect(!(root / "a").Exists());
+
+    TKeyValue other(root / "b");
+    other.Set("key", "b");
+    ExpectSuccess(other.Save());
+    ExpectSuccess(other.Remove());
+    Expect(!!other.Load());
+
+    /* node larger than slot is rejected, storage is not touched */
+    node.Set("key", std::string(70 << 10, 'x'));
+    Expect(!!node.Save());
+    ExpectKvNode(root / "a", "2");
+
+    /* slot smaller than node limit is refused for new store */
+    config().set_keyvalue_store_slot(64 << 10);
+    ExpectSuccess((root / ".store").Unlink());
+    Expect(!!TKeyValue::Mount(root));
+    config().set_keyvalue_store_slot(68 << 10);
+    ExpectSuccess(TKeyValue::Mount(root));
+
+    /* first slots are allocated at mount, next ones are added by growing */
+    for (int i = 0; i < 100; i++) {
+        TKeyValue n(root / std::to_string(i));
+        n.Set("key", std::to_string(i));
+        ExpectSuccess(n.Save());
+    }
+
+    struct stat st;
+    ExpectSuccess((root / ".store").StatStrict(st));
+    ExpectEq((size_t)st.st_size, 4096 + 128 * 2 * (68 << 10));
+
+    for (int i = 0; i < 100; i++)
+        ExpectKvNode(root / std::to_string(i), std::to_string(i));
+
+    /* corrupted latest slot falls back to previous version */
+    ExpectSuccess(root.UmountAll());
+    (void)root.RemoveAll();
+    ExpectSuccess(TKeyValue::Mount(root));
+    node.Set("key", "old");
+    ExpectSuccess(node.Save());
+    node.Set("key", "new");
+    ExpectSuccess(node.Save());
+
+    TFile file;
+    uint32_t crc = 0;
+    ExpectSuccess(file.OpenReadWrite(root / ".store"));
+    /* header page, pair 0 slot 1, crc follows magic */
+    Expect(pwrite(file.Fd, &crc, sizeof(crc), 4096 + (68 << 10) + 4) == sizeof(crc));
+    file.Close();
+
+    ExpectSuccess(TKeyValue::Mount(root));
+    ExpectKvNode(root / "a", "old");
+
+    /* export into files */
+    for (int i = 0; i < 10; i++) {
+        TKeyValue n(root / std::to_string(i));
+        n.Set("key", std::to_string(i));
+        ExpectSuccess(n.Save());
+    }
+
+    config().set_keyvalue_store(false);
+    ExpectSuccess(TKeyValue::Mount(root));
+    Expect(!(root / ".store").Exists());
+    Expect((root / "a").Exists());
+    ExpectKvNode(root / "a", "old");
+    for (int i = 0; i < 10; i++) {
+        Expect((root / std::to_string(i)).Exists());
+        ExpectKvNode(root / std::to_string(i), std::to_string(i));
+    }
+
+    /* and import them back */
+    config().set_keyvalue_store(true);
+    ExpectSuccess(TKeyValue::Mount(root));
+    Expect((root / ".store").Exists());
+    Expect(!(root / "a").Exists());
+    ExpectKvNode(root / "a", "old");
+    for (int i = 0; i < 10; i++) {
+        Expect(!(root / std::to_string(i)).Exists());
+        ExpectKvNode(root / std::to_string(i), std::to_string(i));
+    }
+
+    /* drop store instance before unmounting */
+    config().set_keyvalue_store(false);
+    ExpectSuccess(TKeyValue::Mount(root));
+
+    config() = saved;
+    ExpectSuccess(root.UmountAll());
+    ExpectSuccess(root.RemoveAll());
+}
+
 static void TestRoot(Porto::Connection &api) {
     string v;
     string root = "/";
@@ -5120,7 +5419,11 @@ int SelfTest(std::vector<std::string> args) {
     pair<string, std::function<void(Porto::Connection &)>> tests[] = {
         { "path", TestPath },
         { "idmap", TestIdmap },
+        { "mpmc_queue", TestMpmcQueue },
         { "format", TestFormat },
+        { "log_decode", TestLogDecode },
+        { "kv_delta", TestKvDelta },
+        { "kv_store", TestKvStore },
         { "root", TestRoot },
         { "data", TestData },
         { "holder", TestHolder },
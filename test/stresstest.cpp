@@ -8,6 +8,7 @@
 
 #include "config.hpp"
 #include "util/string.hpp"
+#include "util/unix.hpp"
 #include "test.hpp"
 
 extern "C" {
@@ -256,6 +257,70 @@ static void StressKill() {
     }
 }
 
+/*
+ * Container lock contention in deep hierarchy: writers change property at
+ * random level, readers read property at random level.
+ */
+static void LockTasks(int n, int depth, int iter, std::atomic<uint64_t> &ops) {
+    Porto::Connection api;
+    std::string name, value;
+    unsigned seed = n;
+
+    for (int i = 0; i < iter; i++) {
+        name = "stress-locks";
+        for (int level = rand_r(&seed) % depth; level > 0; level--)
+            name += "/" + std::to_string(level);
+
+        if (rand_r(&seed) % 4 == 0)
+            ExpectApiSuccess(api.SetProperty(name, "private", std::to_string(i)));
+        else
+            ExpectApiSuccess(api.GetProperty(name, "private", value));
+        ops++;
+    }
+}
+
+int StressLocks(int threads, int depth, int iter) {
+    std::vector<std::thread> thrTasks;
+    std::atomic<uint64_t> ops(0);
+    std::string name = "stress-locks";
+    std::string waits, p99;
+
+    try {
+        Porto::Connection api;
+
+        (void)api.Destroy(name);
+        ExpectApiSuccess(api.Create(name));
+        for (int level = depth - 1; level > 0; level--) {
+            name += "/" + std::to_string(level);
+            ExpectApiSuccess(api.Create(name));
+        }
+
+        auto start = GetCurrentTimeMs();
+
+        for (int i = 1; i <= threads; i++)
+            thrTasks.push_back(std::thread(LockTasks, i, depth, iter, std::ref(ops)));
+        for (auto& th : thrTasks)
+            th.join();
+
+        auto time = GetCurrentTimeMs() - start;
+
+        ExpectApiSuccess(api.GetData("/", "porto_stat[lock_waits]", waits));
+        ExpectApiSuccess(api.GetData("/", "porto_stat[lock_wait_p99]", p99));
+        ExpectApiSuccess(api.Destroy("stress-locks"));
+
+        std::cout << "Operations: " << ops << " in " << time << " ms, "
+                  << (time ? ops * 1000 / time : 0) << " ops/s" << std::endl;
+        std::cout << "Lock waits: " << waits << " p99: " << p99 << " us" << std::endl;
+    } catch (std::string e) {
+        std::cerr << "ERROR: " << e << std::endl;
+        abort();
+    }
+
+    std::cout << "Test completed!" << std::endl;
+
+    return 0;
+}
+
 int StressTest(int threads, int iter, bool killPorto) {
     int i;
     std::vector<std::thread> thrTasks;
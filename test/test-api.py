@@ -1,6 +1,7 @@
 import porto
 import sys
 import os
+import subprocess
 
 import test_common
 from test_common import *
@@ -85,12 +86,16 @@ assert a.GetData("state") == "running"
 a.Pause()
 assert a.GetData("state") == "paused"
 
+# served from snapshot, must follow state changes
+assert a.Get(["state", "command", "owner_user"]) == {"state": "paused", "command": "sleep 60", "owner_user": a.GetProperty("owner_user")}
+
 a.Resume()
 assert a.GetData("state") == "running"
 
 a.Kill(9)
 assert a.Wait() == a.name
 assert a.GetData("state") == "dead"
+assert a.Get(["state"]) == {"state": "dead"}
 assert a.GetData("exit_status") == "9"
 
 a.Stop()
@@ -177,6 +182,22 @@ c.DestroyVolume(v.path)
 l.Remove()
 os.rmdir(volume_path)
 
+# async layer import with progress
+request = porto.rpc_pb2.TContainerRequest()
+request.importLayer.layer = layer_name
+request.importLayer.tarball = tarball_path
+request.importLayer.merge = False
+op = c.Async(request)
+rsp = c.Operation(op, timeout=30000)
+assert rsp.id == op
+assert rsp.state == "done"
+assert rsp.result.error == porto.rpc_pb2.Success
+assert rsp.files >= 1
+assert rsp.bytes > 0
+assert c.FindLayer(layer_name).name == layer_name
+c.RemoveLayer(layer_name)
+assert Catch(c.Operation, op + 1000) == porto.exceptions.InvalidValue
+
 a = c.CreateWeakContainer(container_name)
 a.SetProperty("command", "sleep 60")
 a.Start()
@@ -188,3 +209,169 @@ if Catch(c.Find, container_name) != porto.exceptions.ContainerDoesNotExist:
 
 Catch(c.Destroy, container_name)
 c.disconnect()
+
+# pipelined requests: slow wait does not hold back the rest
+c.connect()
+a = c.Create(container_name)
+a.SetProperty("command", "sleep 1")
+a.Start()
+
+wait = porto.rpc_pb2.TContainerRequest()
+wait.wait.name.append(container_name)
+wait.wait.timeout = 5000
+state = porto.rpc_pb2.TContainerRequest()
+state.getProperty.name = container_name
+state.getProperty.property = "state"
+version = porto.rpc_pb2.TContainerRequest()
+version.version.CopyFrom(porto.rpc_pb2.TVersionRequest())
+missing = porto.rpc_pb2.TContainerRequest()
+missing.getProperty.name = container_name + "-missing"
+missing.getProperty.property = "state"
+
+res = c.Pipeline([wait, state, version, missing])
+assert res[0].wait.name == container_name
+assert res[1].getProperty.value == "running"
+assert res[2].version.tag
+assert isinstance(res[3], porto.exceptions.ContainerDoesNotExist)
+
+assert a.GetData("state") == "dead"
+a.Destroy()
+c.disconnect()
+
+# streaming: chunked list and get with continuation tokens
+c.connect()
+names = [container_name + "-" + str(i) for i in range(5)]
+for name in names:
+    c.Create(name)
+
+def ListChunks(kind, max_count):
+    result = []
+    token = None
+    while True:
+        request = porto.rpc_pb2.TContainerRequest()
+        if kind == "list":
+            request.list.mask = container_name + "-*"
+            request.list.max_count = max_count
+            if token is not None:
+                request.list.continuation = token
+            rsp = c.rpc.call(request, c.rpc.timeout).list
+            result += list(rsp.name)
+        else:
+            request.get.name.append(container_name + "-*")
+            request.get.variable.append("state")
+            request.get.max_count = max_count
+            if token is not None:
+                request.get.continuation = token
+            rsp = c.rpc.call(request, c.rpc.timeout).get
+            assert len(rsp.list) <= max_count
+            result += [entry.name for entry in rsp.list]
+        if not rsp.HasField("continuation"):
+            return result
+        token = rsp.continuation
+
+assert ListChunks("list", 2) == sorted(names)
+assert ListChunks("get", 2) == sorted(names)
+assert ListChunks("list", 5) == sorted(names)
+
+for name in names:
+    c.Destroy(name)
+c.disconnect()
+
+# events: subscription with replay by sequence number
+s = porto.Connection()
+s.connect()
+rsp = s.Subscribe(names=[container_name], types=["state"])
+seq = rsp.seq
+
+c.connect()
+a = c.Create(container_name)
+a.SetProperty("command", "true")
+a.Start()
+a.Wait()
+
+states = []
+while "dead" not in states:
+    for event in s.ReadEvents(timeout=5000).event:
+        assert event.name == container_name
+        assert event.seq > seq
+        seq = event.seq
+        states.append(event.value)
+assert states[0] == "starting"
+s.Unsubscribe()
+s.disconnect()
+
+s.connect()
+rsp = s.Subscribe(names=[container_name], since=0)
+assert "dead" in [event.value for event in rsp.event if event.type == "state"]
+assert "exit" in [event.type for event in rsp.event]
+s.Unsubscribe()
+s.disconnect()
+
+a.Destroy()
+c.disconnect()
+
+# wildcard waiters are woken only by names under their prefix
+c.connect()
+a = c.Create(container_name + "-y1")
+a.SetProperty("command", "sleep 1")
+a.Start()
+
+waits = []
+for mask, timeout in [("-x*", 3000), ("-y*", 5000), ("-y?", 5000), ("*", 5000)]:
+    wait = porto.rpc_pb2.TContainerRequest()
+    wait.wait.name.append(container_name + mask if mask != "*" else mask)
+    wait.wait.timeout = timeout
+    waits.append(wait)
+
+res = c.Pipeline(waits)
+assert res[0].wait.name == ""
+assert res[1].wait.name == container_name + "-y1"
+assert res[2].wait.name == container_name + "-y1"
+assert res[3].wait.name != ""
+
+a.Destroy()
+c.disconnect()
+
+# masks are served from name ranges
+c.connect()
+for name in ["-a", "-a/b", "-ab", "-b"]:
+    c.Create(container_name + name)
+assert list(c.List(mask=container_name + "-a/*")) == [container_name + "-a/b"]
+assert list(c.List(mask=container_name + "-a*")) == [container_name + "-a", container_name + "-ab"]
+assert container_name + "-b" in c.List(mask="***")
+for name in ["-a/b", "-a", "-ab", "-b"]:
+    c.Destroy(container_name + name)
+c.disconnect()
+
+# request traces are collected when enabled in config, only for superuser
+AsRoot()
+conf = "/etc/portod.conf"
+saved = open(conf).read() if os.path.exists(conf) else None
+try:
+    open(conf, "w").write((saved or "") + "\ndaemon { request_trace: true }\n")
+    subprocess.check_call([portod, "reload"])
+
+    c.connect()
+    a = c.Create(container_name)
+    a.Destroy()
+    traces = c.Traces()
+    assert ("destroy " + container_name) in [t.request for t in traces]
+    slowest = c.Traces(slowest=True)
+    assert len(slowest) > 0
+    assert slowest[0].total_us >= slowest[-1].total_us
+    c.disconnect()
+finally:
+    if saved is None:
+        os.unlink(conf)
+    else:
+        open(conf, "w").write(saved)
+    subprocess.check_call([portod, "reload"])
+
+c.connect()
+try:
+    c.Traces()
+    assert False, "request tracing must be disabled by default"
+except porto.exceptions.NotSupported:
+    pass
+c.disconnect()
+AsAlice()
@@ -705,6 +705,167 @@ def TestPersistentStorage():
     ExpectEq(len(c.ListStorage()), 0)
 
 
+def TestTypedProperties():
+    print "Make sure legacy text and typed properties are restored alike"
+
+    AsRoot()
+
+    c = porto.Connection(timeout=30)
+
+    props = {
+        "command" : "sleep 1000",
+        "env" : "A=1;B=b c",
+        "hostname" : "typed",
+        "isolate" : "false",
+        "ulimit" : "nofile: 1024 2048",
+        "capabilities" : "CHOWN;KILL;NET_BIND_SERVICE",
+        "max_respawns" : "3",
+        "private" : "typed-test",
+        "aging_time" : "100",
+        "weak" : "false",
+        "oom_score_adj" : "10",
+        "ip_limit" : "any",
+        "memory_limit" : "64M",
+        "cpu_limit" : "1c",
+    }
+
+    # depend on kernel and networking
+    optional = {
+        "anon_limit" : "32M",
+        "io_limit" : "fs: 1000000",
+        "thread_limit" : "100",
+        "net_limit" : "default: 1024",
+    }
+
+    def Setup(name):
+        r = c.Create(name)
+        for k, v in props.items():
+            r.SetProperty(k, v)
+        for k, v in optional.items():
+            try:
+                r.SetProperty(k, v)
+            except (porto.exceptions.NotSupported, porto.exceptions.InvalidValue):
+                pass
+        return Values(name)
+
+    def Values(name):
+        values = {}
+        for k in props.keys() + optional.keys():
+            try:
+                values[k] = c.GetProperty(name, k)
+            except porto.exceptions.NotSupported:
+                pass
+        return values
+
+    conf = "/etc/portod.conf"
+    saved = open(conf).read() if os.path.exists(conf) else None
+
+    # default config saves properties as text
+    legacy = Setup("legacy")
+
+    try:
+        open(conf, "w").write((saved or "") + "\nkeyvalue_typed: true\n")
+        subprocess.check_call([portod, "reload"])
+
+        ExpectEq(Values("legacy"), legacy)
+
+        typed = Setup("typed")
+        ExpectEq(typed, legacy)
+
+        # resave legacy node as typed
+        c.SetProperty("legacy", "private", "typed-test")
+
+        subprocess.check_call([portod, "reload"])
+
+        ExpectEq(Values("legacy"), legacy)
+        ExpectEq(Values("typed"), legacy)
+    finally:
+        if saved is None:
+            os.unlink(conf)
+        else:
+            open(conf, "w").write(saved)
+
+    subprocess.check_call([portod, "reload"])
+
+    ExpectEq(Values("legacy"), legacy)
+    ExpectEq(Values("typed"), legacy)
+
+    c.Destroy("legacy")
+    c.Destroy("typed")
+
+    ExpectEq(c.GetProperty("/", "porto_stat[errors]"), "0")
+
+def TestLazyRestore():
+    print "Make sure requests are served while lazy restore is running"
+
+    AsRoot()
+
+    c = porto.Connection(timeout=30)
+
+    def Run(name):
+        r = c.Create(name)
+        r.SetProperty("command", "sleep 1000")
+        r.Start()
+
+    c.Create("lazy")
+    for i in range(200):
+        Run("lazy/c%d" % i)
+    Run("quick")
+
+    v = c.CreateVolume(None, containers="lazy/c0")
+    path = v.path
+
+    conf = "/etc/portod.conf"
+    saved = open(conf).read() if os.path.exists(conf) else None
+
+    try:
+        open(conf, "w").write((saved or "") +
+                "\ndaemon { lazy_restore: true restore_threads: 1 }\n")
+        subprocess.check_call([portod, "reload"])
+
+        # first request of another subtree must not wait for whole restore
+        pending = False
+        try:
+            c.Get(["lazy/c199"], ["state"], nonblock=True)
+        except porto.exceptions.Busy:
+            pending = True
+
+        ExpectEq(c.Get(["quick"], ["state", "cpu_usage"])["quick"]["state"], "running")
+        ExpectEq(c.GetProperty("quick", "command"), "sleep 1000")
+        ExpectEq(len([name for name in c.List() if name.startswith("lazy/")]), 200)
+        ExpectEq(c.FindVolume(path).path, path)
+
+        c.Destroy("quick")
+        Run("quick")
+
+        print "restore was %s at first request" % ("pending" if pending else "done")
+
+        # blocking request waits until container is synced
+        for i in range(200):
+            ExpectEq(c.GetProperty("lazy/c%d" % i, "state"), "running")
+        ExpectEq(c.Get(["lazy/c199"], ["state"], nonblock=True)["lazy/c199"]["state"], "running")
+        ExpectEq([ct.name for ct in c.FindVolume(path).GetContainers()], ["lazy/c0"])
+    finally:
+        if saved is None:
+            os.unlink(conf)
+        else:
+            open(conf, "w").write(saved)
+
+    subprocess.check_call([portod, "reload"])
+
+    ExpectEq(c.GetProperty("lazy/c199", "state"), "running")
+
+    c.Destroy("quick")
+    c.Destroy("lazy")
+
+    try:
+        c.FindVolume(path)
+        raise AssertionError("volume {} survived destroy".format(path))
+    except porto.exceptions.VolumeNotFound:
+        pass
+
+    ExpectEq(c.GetProperty("/", "porto_stat[errors]"), "0")
+
 
 subprocess.check_call([portod, "--verbose", "reload"])
 ret = 0
@@ -715,6 +876,8 @@ try:
     TestVolumeRecovery()
     TestTCCleanup()
     TestPersistentStorage()
+    TestTypedProperties()
+    TestLazyRestore()
 except BaseException as e:
     print traceback.format_exc()
     ret = 1
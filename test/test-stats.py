@@ -10,3 +10,14 @@ for s in root_stats:
     pair = s.split(':')
     print "{} : {}".format(pair[0], pair[1])
 
+
+# latency histograms are collected for each tracked request type
+ExpectNe(c.GetProperty("/", "porto_stat[requests_getproperty]"), "0")
+ExpectNe(c.GetProperty("/", "porto_stat[latency_getproperty_exec_p99]"), "0")
+
+hist = c.GetProperty("/", "porto_stat[latency_getproperty_wait]").split(';')
+ExpectEq(len(hist), 32)
+
+# lock wait time of containers
+int(c.GetProperty("/", "porto_stat[lock_waits]"))
+ExpectEq(len(c.GetProperty("/", "porto_stat[lock_wait]").split(';')), 32)
@@ -70,7 +70,9 @@ namespace test {
 
     int SelfTest(std::vector<std::string> args);
     int StressTest(int threads, int iter, bool killPorto);
+    int StressLocks(int threads, int depth, int iter);
     int FuzzyTest(int threads, int iter);
+    int Benchmark(std::vector<std::string> args);
 
     enum class KernelFeature {
         LOW_LIMIT,